@@ -1,8 +1,17 @@
 #include <assert.h>
+#include <inttypes.h>
 #include <pango/pangocairo.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "bottom-panel.h"
 #include "buffer.h"
+#include "candidates.h"
+#include "cell-cache.h"
+#include "errors.h"
+#include "glyph-atlas.h"
+#include "layout-cache.h"
 #include "wlchewing.h"
 #include "xmem.h"
 
@@ -13,11 +22,21 @@ static void layer_surface_configure(void *data,
 	panel->width = w;
 	panel->height = h;
 	zwlr_layer_surface_v1_ack_configure(layer_surface, serial);
+	panel->configured = true;
+	if (panel->shown) {
+		bottom_panel_render(panel->state);
+	}
 }
 
 static void layer_surface_closed(void *data,
 		struct zwlr_layer_surface_v1 *layer_surface) {
 	struct wlchewing_bottom_panel *panel = data;
+	struct wlchewing_state *state = panel->state;
+	if (state->bottom_panel == panel) {
+		state->bottom_panel = NULL;
+	}
+	// prepared again when needed
+	state->persistent_bottom_panel = NULL;
 	bottom_panel_destroy(panel);
 }
 
@@ -26,12 +45,32 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
 	.closed		= layer_surface_closed,
 };
 
+static void panel_set_scale(struct wlchewing_bottom_panel *panel,
+		int32_t scale) {
+	bool changed = panel->scale != scale;
+	panel->scale = scale;
+	if (changed && panel->shown) {
+		bottom_panel_render(panel->state);
+	}
+}
+
 static void surface_preferred_buffer_scale(void *data,
 		struct wl_surface *surface, int32_t scale) {
 	struct wlchewing_bottom_panel *panel = data;
-	panel->scale = scale;
+	if (!panel->fractional_scale) {
+		panel_set_scale(panel, scale * scale_unit);
+	}
+}
+
+static void fractional_scale_preferred_scale(void *data,
+		struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+	panel_set_scale(data, scale);
 }
 
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+	.preferred_scale	= fractional_scale_preferred_scale,
+};
+
 static void surface_enter(void *data, struct wl_surface *surface,
 		struct wl_output *output) {
 	struct wlchewing_bottom_panel *panel = data;
@@ -48,46 +87,54 @@ static const struct wl_surface_listener surface_listener = {
 };
 
 static constexpr int cand_padding = 4;
+// widest tile with --strip in buffer pixels, within what compositors take
+static constexpr int strip_tile_size = 8192;
 
-static int render_cand(struct wlchewing_state *state,
-		struct wlchewing_buffer *buffer, const char *text, int index) {
-	char hint[2] = {
-		(state->config.key_hint && index < 10) ?
-			index == 9 ? '0' : '1' + index : 0,
-		0
-	};
-	int width, hint_width = 0;
-	if (hint[0]) {
-		pango_layout_set_text(state->bottom_panel_key_hint_layout, hint, -1);
-		pango_layout_get_pixel_size(state->bottom_panel_key_hint_layout, &hint_width, NULL);
-	}
-	pango_layout_set_text(state->bottom_panel_text_layout, text, -1);
-	pango_layout_get_pixel_size(state->bottom_panel_text_layout, &width, NULL);
-	width += hint_width;
+static void *render_worker_run(void *data);
+
+static char cand_hint(struct wlchewing_state *state, int hint_index) {
+	return (state->config.key_hint && hint_index < 10) ?
+		hint_index == 9 ? '0' : '1' + hint_index : 0;
+}
+
+// hint is the index on the page, widths come from the measured candidates
+static void render_cand(struct wlchewing_render_worker *worker,
+		cairo_t *cairo, struct wlchewing_render_job *job,
+		int index, int hint_index) {
+	struct wlchewing_state *state = worker->state;
+	struct wlchewing_candidates *candidates = job->candidates;
+	const uint32_t height = job->height;
+	const bool selected = index == job->selected_index;
+	char hint[2] = {cand_hint(state, hint_index), 0};
 
-	const int cell_width = width + cand_padding * 2;
-	if (!index) {
-		cairo_set_source_rgba(buffer->cairo,
+	const int cell_width = candidates_cell_width(candidates, index);
+	if (selected && !state->config.offload) {
+		cairo_set_source_rgba(cairo,
 			state->config.selection_color[0],
 			state->config.selection_color[1],
 			state->config.selection_color[2],
 			state->config.selection_color[3]);
-		cairo_rectangle(buffer->cairo, 0, 0, cell_width, state->bottom_panel->buffer_pool->height);
-		cairo_fill(buffer->cairo);
+		cairo_rectangle(cairo, 0, 0, cell_width, height);
+		cairo_fill(cairo);
 	}
 
-	const double *text_color = !index ?
+	const double *text_color = selected ?
 		state->config.selection_text_color :
 		state->config.text_color;
-	cairo_set_source_rgba(buffer->cairo, text_color[0], text_color[1],
+	cairo_set_source_rgba(cairo, text_color[0], text_color[1],
 		text_color[2], text_color[3]);
-	cairo_move_to(buffer->cairo, cand_padding, 0);
+	cairo_move_to(cairo, cand_padding, 0);
 	if (hint[0]) {
-		pango_cairo_show_layout(buffer->cairo, state->bottom_panel_key_hint_layout);
-		cairo_move_to(buffer->cairo, cand_padding + hint_width, 0);
+		// shown before the next lookup may evict it
+		pango_cairo_show_layout(cairo, layout_cache_get(
+			worker->layout_cache, LAYOUT_KEY_HINT, hint,
+			job->scale, job->subpixel)->layout);
+		cairo_move_to(cairo, cand_padding +
+			candidates->hint_widths[hint_index], 0);
 	}
-	pango_cairo_show_layout(buffer->cairo, state->bottom_panel_text_layout);
-	return cell_width;
+	pango_cairo_show_layout(cairo, layout_cache_get(worker->layout_cache,
+		LAYOUT_TEXT, candidates_get(candidates, index), job->scale,
+		job->subpixel)->layout);
 }
 
 int bottom_panel_init(struct wlchewing_state *state) {
@@ -117,20 +164,149 @@ int bottom_panel_init(struct wlchewing_state *state) {
 	int height;
 	pango_layout_get_pixel_size(state->bottom_panel_text_layout, NULL, &height);
 	state->bottom_panel_text_height = height;
+
+	// layouts are only used by the worker from now on
+	struct wlchewing_render_worker *worker = xcalloc(1,
+		sizeof(struct wlchewing_render_worker));
+	worker->state = state;
+	worker->layout_cache = layout_cache_new(
+		state->bottom_panel_text_layout,
+		state->bottom_panel_key_hint_layout,
+		(size_t)state->config.layout_cache_kib * 1024);
+	worker->cell_cache = cell_cache_new(
+		(size_t)state->config.cell_cache_kib * 1024);
+	worker->glyph_atlas = glyph_atlas_new();
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->cond, NULL);
+	worker->event_fd = must_errno(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+		"create eventfd");
+	// SIGINT and SIGTERM are for the signalfd of the main thread, the
+	// worker may be started before they are blocked there
+	sigset_t signals, old_signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+	int ret = pthread_create(&worker->thread, NULL, render_worker_run,
+		worker);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (ret) {
+		errno = ret;
+		wlchewing_perr("Failed to start render worker");
+		exit(EXIT_FAILURE);
+	}
+	state->render_worker = worker;
 	return 0;
 }
 
-struct wlchewing_bottom_panel *bottom_panel_new(struct wlchewing_state *state) {
+void bottom_panel_finish(struct wlchewing_state *state) {
+	struct wlchewing_render_worker *worker = state->render_worker;
+	pthread_mutex_lock(&worker->lock);
+	worker->stop = true;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+	pthread_join(worker->thread, NULL);
+	layout_cache_destroy(worker->layout_cache);
+	cell_cache_destroy(worker->cell_cache);
+	glyph_atlas_destroy(worker->glyph_atlas);
+	close(worker->event_fd);
+	pthread_mutex_destroy(&worker->lock);
+	pthread_cond_destroy(&worker->cond);
+	free(worker);
+	state->render_worker = NULL;
+}
+
+static struct wl_buffer *single_pixel_buffer(struct wlchewing_state *state,
+		const double color[4]) {
+	// premultiplied, over the whole range of uint32_t
+	return wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+		state->wl_globals.single_pixel_buffer_manager,
+		color[0] * color[3] * UINT32_MAX,
+		color[1] * color[3] * UINT32_MAX,
+		color[2] * color[3] * UINT32_MAX, color[3] * UINT32_MAX);
+}
+
+static void offload_prepare(struct wlchewing_state *state,
+		struct wlchewing_bottom_panel *panel) {
+	struct wlchewing_wl_globals *globals = &state->wl_globals;
+	panel->viewport = wp_viewporter_get_viewport(globals->viewporter,
+		panel->wl_surface);
+	panel->background_buffer = single_pixel_buffer(state,
+		state->config.background_color);
+
+	// stacked in the order created, candidates on top
+	panel->highlight_surface = wl_compositor_create_surface(
+		globals->compositor);
+	panel->highlight_subsurface = wl_subcompositor_get_subsurface(
+		globals->subcompositor, panel->highlight_surface,
+		panel->wl_surface);
+	panel->highlight_viewport = wp_viewporter_get_viewport(
+		globals->viewporter, panel->highlight_surface);
+	panel->highlight_buffer = single_pixel_buffer(state,
+		state->config.selection_color);
+	wl_surface_attach(panel->highlight_surface, panel->highlight_buffer,
+		0, 0);
+	panel->text_surface = wl_compositor_create_surface(globals->compositor);
+	panel->text_subsurface = wl_subcompositor_get_subsurface(
+		globals->subcompositor, panel->text_surface, panel->wl_surface);
+	if (state->config.strip || panel->fractional_scale) {
+		// scrolled over the tiles, or buffers in device pixels
+		panel->text_viewport = wp_viewporter_get_viewport(
+			globals->viewporter, panel->text_surface);
+	}
+
+	// clicks go to wl_surface for hit testing
+	struct wl_region *region = wl_compositor_create_region(
+		globals->compositor);
+	wl_surface_set_input_region(panel->highlight_surface, region);
+	wl_surface_set_input_region(panel->text_surface, region);
+	if (state->config.selection_color[3] == 1.0) {
+		wl_region_add(region, 0, 0, INT32_MAX, INT32_MAX);
+		wl_surface_set_opaque_region(panel->highlight_surface, region);
+	}
+	wl_region_destroy(region);
+}
+
+void bottom_panel_prepare(struct wlchewing_state *state) {
+	if (state->persistent_bottom_panel) {
+		return;
+	}
 	assert(state->bottom_panel_text_layout);
 	struct wlchewing_bottom_panel *panel = xcalloc(1,
 		sizeof(struct wlchewing_bottom_panel));
+	panel->state = state;
 	panel->height = state->bottom_panel_text_height;
 	panel->width = 1;
-	panel->scale = 1;
+	panel->scale = scale_unit;
 	panel->subpixel = WL_OUTPUT_SUBPIXEL_UNKNOWN;
 	panel->wl_surface = wl_compositor_create_surface(state->wl_globals.compositor);
 	assert(panel->wl_surface);
 	wl_surface_add_listener(panel->wl_surface, &surface_listener, panel);
+	if (state->wl_globals.fractional_scale_manager &&
+			state->wl_globals.viewporter) {
+		panel->fractional_scale =
+			wp_fractional_scale_manager_v1_get_fractional_scale(
+			state->wl_globals.fractional_scale_manager,
+			panel->wl_surface);
+		wp_fractional_scale_v1_add_listener(panel->fractional_scale,
+			&fractional_scale_listener, panel);
+		if (!state->config.offload) {
+			panel->viewport = wp_viewporter_get_viewport(
+				state->wl_globals.viewporter,
+				panel->wl_surface);
+		}
+	}
+	if (state->config.background_color[3] == 1.0) {
+		// nothing below needs drawing, clipped to the surface
+		struct wl_region *opaque = wl_compositor_create_region(
+			state->wl_globals.compositor);
+		wl_region_add(opaque, 0, 0, INT32_MAX, INT32_MAX);
+		wl_surface_set_opaque_region(panel->wl_surface, opaque);
+		wl_region_destroy(opaque);
+	}
+	if (state->config.offload) {
+		offload_prepare(state, panel);
+	}
 	panel->layer_surface = zwlr_layer_shell_v1_get_layer_surface(
 		state->wl_globals.layer_shell, panel->wl_surface, NULL,
 		ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY, "input-method-panel");
@@ -144,95 +320,1021 @@ struct wlchewing_bottom_panel *bottom_panel_new(struct wlchewing_state *state) {
 		ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
 		ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT);
 	zwlr_layer_surface_v1_set_size(panel->layer_surface, 0, panel->height);
-	wl_surface_commit(panel->wl_surface);
-	// obtain width (and probably height) via layer_surface configure
-	// compositors may also send preferred_buffer_scale here
-	wl_display_roundtrip(state->display);
-
 	zwlr_layer_surface_v1_set_exclusive_zone(panel->layer_surface,
 		state->config.dock == DOCK_DOCK ? panel->height :
 		state->config.dock == DOCK_YEILD ? 0 : -1);
-	wl_surface_set_buffer_scale(panel->wl_surface, panel->scale);
-	panel->buffer_pool = buffer_pool_new(state->wl_globals.shm,
-		panel->width, panel->height, panel->scale);
+	// obtain width (and probably height) via layer_surface configure
+	// compositors may also send preferred_buffer_scale or preferred_scale
+	// here
+	wl_surface_commit(panel->wl_surface);
+	state->persistent_bottom_panel = panel;
+}
 
+struct wlchewing_bottom_panel *bottom_panel_open(struct wlchewing_state *state) {
+	bottom_panel_prepare(state);
+	struct wlchewing_bottom_panel *panel = state->persistent_bottom_panel;
+	panel->shown = true;
+	panel->selected_index = 0;
+	panel->candidates_stale = true;
 	return panel;
 }
 
+void bottom_panel_candidates_changed(struct wlchewing_bottom_panel *panel) {
+	panel->candidates_stale = true;
+}
+
+static bool bottom_panel_laid_out(struct wlchewing_bottom_panel *panel) {
+	// the worker may still be measuring the first ones
+	return panel->candidates && !panel->candidates_stale &&
+		panel->laid_out;
+}
+
+int bottom_panel_page_start(struct wlchewing_bottom_panel *panel) {
+	if (!bottom_panel_laid_out(panel)) {
+		// the first page will start there
+		return panel->selected_index;
+	}
+	return candidates_page_start(panel->candidates, candidates_page_of(
+		panel->candidates, panel->selected_index));
+}
+
+bool bottom_panel_move_page(struct wlchewing_bottom_panel *panel, int pages) {
+	if (!bottom_panel_laid_out(panel)) {
+		return false;
+	}
+	int page = candidates_page_of(panel->candidates,
+		panel->selected_index) + pages;
+	if (page < 0) {
+		page = 0;
+	} else if (page >= panel->candidates->page_count) {
+		page = panel->candidates->page_count - 1;
+	}
+	panel->selected_index = candidates_page_start(panel->candidates, page);
+	return true;
+}
+
+int bottom_panel_hit_test(struct wlchewing_bottom_panel *panel, double x) {
+	if (!bottom_panel_laid_out(panel) ||
+			panel->presented_page_serial != panel->page_serial) {
+		return -1;
+	}
+	return candidates_at(panel->candidates, candidates_page_of(
+		panel->candidates, panel->presented_index), x);
+}
+
+static void strip_destroy(struct wlchewing_bottom_panel *panel) {
+	struct wlchewing_strip *strip = panel->strip;
+	for (int t = 0; t < strip->tile_count; t++) {
+		if (!strip->tiles[t]) {
+			continue;
+		}
+		if (t == strip->attached) {
+			// contents of a destroyed buffer are undefined
+			assert(!panel->retired_tile);
+			panel->retired_tile = strip->tiles[t];
+		} else {
+			buffer_destroy(strip->tiles[t]);
+		}
+	}
+	free(strip->tiles);
+	free(strip->drawn);
+	free(strip);
+	panel->strip = NULL;
+}
+
+void bottom_panel_close(struct wlchewing_bottom_panel *panel) {
+	panel->shown = false;
+	// not coming while unmapped
+	if (panel->frame_callback) {
+		wl_callback_destroy(panel->frame_callback);
+		panel->frame_callback = NULL;
+	}
+	// drop what is being rendered
+	panel->generation++;
+	atomic_store(&panel->state->render_worker->generation,
+		panel->generation);
+	if (panel->text_surface) {
+		// its buffer goes back to the pool
+		wl_surface_attach(panel->text_surface, NULL, 0, 0);
+		wl_surface_commit(panel->text_surface);
+		panel->background_attached = false;
+		if (panel->strip) {
+			panel->strip->attached = -1;
+		}
+		if (panel->retired_tile) {
+			buffer_destroy(panel->retired_tile);
+			panel->retired_tile = NULL;
+		}
+	}
+	wl_surface_attach(panel->wl_surface, NULL, 0, 0);
+	wl_surface_commit(panel->wl_surface);
+	// unmapped layer surface needs another initial commit, do it now so
+	// that the configure is already there on next open
+	panel->configured = false;
+	wl_surface_commit(panel->wl_surface);
+}
+
 void bottom_panel_destroy(struct wlchewing_bottom_panel *panel) {
+	struct wlchewing_render_worker *worker = panel->state->render_worker;
+	if (panel->rendering) {
+		// the buffer being painted goes away with the pool
+		atomic_store(&worker->generation, 0);
+		pthread_mutex_lock(&worker->lock);
+		while (!worker->has_done) {
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		}
+		worker->has_done = false;
+		pthread_mutex_unlock(&worker->lock);
+	}
+	if (panel->frame_callback) {
+		wl_callback_destroy(panel->frame_callback);
+	}
+	if (panel->text_surface) {
+		if (panel->text_viewport) {
+			wp_viewport_destroy(panel->text_viewport);
+		}
+		wl_subsurface_destroy(panel->text_subsurface);
+		wl_surface_destroy(panel->text_surface);
+		wp_viewport_destroy(panel->highlight_viewport);
+		wl_subsurface_destroy(panel->highlight_subsurface);
+		wl_surface_destroy(panel->highlight_surface);
+		wl_buffer_destroy(panel->highlight_buffer);
+		wl_buffer_destroy(panel->background_buffer);
+	}
+	if (panel->viewport) {
+		wp_viewport_destroy(panel->viewport);
+	}
+	if (panel->fractional_scale) {
+		wp_fractional_scale_v1_destroy(panel->fractional_scale);
+	}
 	zwlr_layer_surface_v1_destroy(panel->layer_surface);
 	wl_surface_destroy(panel->wl_surface);
-	buffer_pool_destroy(panel->buffer_pool);
+	if (panel->buffer_pool) {
+		buffer_pool_destroy(panel->buffer_pool);
+	}
+	if (panel->strip) {
+		strip_destroy(panel);
+	}
+	if (panel->retired_tile) {
+		buffer_destroy(panel->retired_tile);
+	}
+	if (panel->candidates) {
+		candidates_destroy(panel->candidates);
+	}
 	free(panel);
 }
 
-cairo_subpixel_order_t buffer_subpixel_to_cairo[] = {
-	[WL_OUTPUT_SUBPIXEL_UNKNOWN]		= CAIRO_SUBPIXEL_ORDER_DEFAULT,
-	[WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB]	= CAIRO_SUBPIXEL_ORDER_RGB,
-	[WL_OUTPUT_SUBPIXEL_HORIZONTAL_BGR]	= CAIRO_SUBPIXEL_ORDER_BGR,
-	[WL_OUTPUT_SUBPIXEL_VERTICAL_RGB]	= CAIRO_SUBPIXEL_ORDER_VRGB,
-	[WL_OUTPUT_SUBPIXEL_VERTICAL_BGR]	= CAIRO_SUBPIXEL_ORDER_VBGR,
+static void render_background(struct wlchewing_state *state, cairo_t *cairo) {
+	if (state->config.offload) {
+		// shown by the compositor below
+		cairo_set_source_rgba(cairo, 0, 0, 0, 0);
+	} else {
+		cairo_set_source_rgba(cairo,
+			state->config.background_color[0],
+			state->config.background_color[1],
+			state->config.background_color[2],
+			state->config.background_color[3]);
+	}
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cairo);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+}
+
+// copies the cell at x, painting it first if not cached
+static void blit_cand(struct wlchewing_render_worker *worker, cairo_t *cairo,
+		struct wlchewing_render_job *job, int index, int hint_index,
+		int x) {
+	struct wlchewing_state *state = worker->state;
+	const char *text = candidates_get(job->candidates, index);
+	const char hint = cand_hint(state, hint_index);
+	const bool selected = index == job->selected_index;
+	const int width = candidates_cell_width(job->candidates, index);
+	struct wlchewing_cell_entry *entry = cell_cache_find(
+		worker->cell_cache, text, hint, selected, job->scale,
+		job->subpixel, width, job->height);
+	// copied pixel for pixel, a column more than the cell for where
+	// fractional scales round it up
+	const int x0 = scale_pixels(x, job->scale);
+	const int x1 = scale_pixels(x + width, job->scale);
+	if (!entry) {
+		cairo_surface_t *image = cairo_image_surface_create(
+			CAIRO_FORMAT_ARGB32, scale_pixels(width, job->scale) +
+			(job->scale % scale_unit != 0),
+			scale_pixels(job->height, job->scale));
+		cairo_t *cell = cairo_create(image);
+		cairo_scale(cell, (double)job->scale / scale_unit,
+			(double)job->scale / scale_unit);
+		render_background(state, cell);
+		render_cand(worker, cell, job, index, hint_index);
+		cairo_destroy(cell);
+		entry = cell_cache_insert(worker->cell_cache, text, hint,
+			selected, job->scale, job->subpixel, width,
+			job->height, image);
+	}
+	cairo_save(cairo);
+	cairo_identity_matrix(cairo);
+	cairo_set_source_surface(cairo, entry->image, x0, 0);
+	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle(cairo, x0, 0, x1 - x0,
+		cairo_image_surface_get_height(entry->image));
+	cairo_fill(cairo);
+	cairo_restore(cairo);
+}
+
+// paints the cell at x, blending glyphs straight into the buffer
+static void glyph_cand(struct wlchewing_render_worker *worker, cairo_t *cairo,
+		struct wlchewing_render_job *job, int index, int hint_index,
+		int x) {
+	struct wlchewing_state *state = worker->state;
+	struct wlchewing_candidates *candidates = job->candidates;
+	const bool selected = index == job->selected_index;
+	const int width = candidates_cell_width(candidates, index);
+	cairo_save(cairo);
+	cairo_rectangle(cairo, x, 0, width, job->height);
+	cairo_clip(cairo);
+	render_background(state, cairo);
+	if (selected && !state->config.offload) {
+		cairo_set_source_rgba(cairo,
+			state->config.selection_color[0],
+			state->config.selection_color[1],
+			state->config.selection_color[2],
+			state->config.selection_color[3]);
+		cairo_paint(cairo);
+	}
+	cairo_restore(cairo);
+
+	cairo_surface_t *target = cairo_get_target(cairo);
+	cairo_surface_flush(target);
+	const int32_t scale = job->scale;
+	const int clip[4] = {
+		scale_pixels(x, scale), 0, scale_pixels(x + width, scale),
+		scale_pixels(job->height, scale),
+	};
+	const double *color = selected ? state->config.selection_text_color :
+		state->config.text_color;
+	int text_x = x + cand_padding;
+	const char hint[2] = {cand_hint(state, hint_index), 0};
+	if (hint[0]) {
+		// drawn before the next lookup may evict it
+		glyph_atlas_draw(worker->glyph_atlas, target, layout_cache_get(
+			worker->layout_cache, LAYOUT_KEY_HINT, hint, scale,
+			job->subpixel)->layout, scale, job->subpixel, color,
+			scale_pixels(text_x, scale), 0, clip);
+		text_x += candidates->hint_widths[hint_index];
+	}
+	glyph_atlas_draw(worker->glyph_atlas, target, layout_cache_get(
+		worker->layout_cache, LAYOUT_TEXT,
+		candidates_get(candidates, index), scale,
+		job->subpixel)->layout, scale, job->subpixel, color,
+		scale_pixels(text_x, scale), 0, clip);
+	cairo_surface_mark_dirty(target);
+}
+
+// where the runs of a hint or text go
+struct row_segment {
+	int begin; // byte offset
+	bool placed;
+	int x; // of its first run in the layout, pango units
 };
 
-void bottom_panel_render(struct wlchewing_state *state) {
-	int total = chewing_cand_TotalChoice(state->chewing);
-	assert(state->bottom_panel->selected_index < total);
+// one attributed string for the page, shaped in one go, with the runs of
+// each cell drawn where the other renderers put it
+static void render_row(struct wlchewing_render_worker *worker, cairo_t *cairo,
+		struct wlchewing_render_job *job, int start, int end) {
+	struct wlchewing_state *state = worker->state;
+	struct wlchewing_candidates *candidates = job->candidates;
+	const int origin = candidates->cell_x[start];
+	if (job->selected_index >= start && job->selected_index < end &&
+			!state->config.offload) {
+		cairo_set_source_rgba(cairo,
+			state->config.selection_color[0],
+			state->config.selection_color[1],
+			state->config.selection_color[2],
+			state->config.selection_color[3]);
+		cairo_rectangle(cairo,
+			candidates->cell_x[job->selected_index] - origin, 0,
+			candidates_cell_width(candidates, job->selected_index),
+			job->height);
+		cairo_fill(cairo);
+	}
 
-	struct wlchewing_bottom_panel *panel = state->bottom_panel;
-	struct wlchewing_buffer_pool *pool = panel->buffer_pool;
-	struct wlchewing_buffer *buffer = buffer_pool_get_buffer(pool);
-	cairo_t *cairo = buffer->cairo;
+	// a tab keeping cells apart when shaping and a hint for each, the nul
+	// is not copied
+	const int count = end - start;
+	size_t size = candidates->offsets[end] - candidates->offsets[start] +
+		count;
+	char *row = xcalloc(size + 1, 1), *out = row;
+	// hint then text of each cell, and the end
+	struct row_segment *segments = xcalloc(2 * count + 1,
+		sizeof(struct row_segment));
+	PangoAttrList *attrs = pango_attr_list_new();
+	for (int i = 0; i < count; i++) {
+		*out++ = '\t';
+		segments[2 * i].begin = out - row;
+		const char hint = cand_hint(state, i);
+		if (hint) {
+			// as the key hint layout
+			PangoAttribute *hint_attrs[] = {
+				pango_attr_line_height_new(1.1),
+				pango_attr_scale_new(0.75),
+			};
+			for (size_t a = 0; a < 2; a++) {
+				hint_attrs[a]->start_index = out - row;
+				hint_attrs[a]->end_index = out - row + 1;
+				pango_attr_list_insert(attrs, hint_attrs[a]);
+			}
+			*out++ = hint;
+		}
+		segments[2 * i + 1].begin = out - row;
+		out = stpcpy(out, candidates_get(candidates, start + i));
+	}
+	segments[2 * count].begin = out - row;
+
+	PangoLayout *layout = layout_cache_layout(worker->layout_cache,
+		LAYOUT_TEXT, job->scale, job->subpixel);
+	pango_layout_set_attributes(layout, attrs);
+	pango_layout_set_text(layout, row, out - row);
+	// those of the separate layouts, as all are drawn from the top
+	double baselines[2] = {
+		0, (double)pango_layout_get_baseline(layout) / PANGO_SCALE,
+	};
+	if (cand_hint(state, 0)) {
+		baselines[0] = (double)pango_layout_get_baseline(layout_cache_get(
+			worker->layout_cache, LAYOUT_KEY_HINT, "1", job->scale,
+			job->subpixel)->layout) / PANGO_SCALE;
+	}
+
+	PangoLayoutIter *iter = pango_layout_get_iter(layout);
+	do {
+		PangoLayoutRun *run = pango_layout_iter_get_run_readonly(iter);
+		if (!run || row[run->item->offset] == '\t') {
+			continue;
+		}
+		int s = 0;
+		while (s < 2 * count - 1 &&
+				run->item->offset >= segments[s + 1].begin) {
+			s++;
+		}
+		PangoRectangle logical;
+		pango_layout_iter_get_run_extents(iter, NULL, &logical);
+		if (!segments[s].placed) {
+			segments[s].placed = true;
+			segments[s].x = logical.x;
+		}
+		const int i = start + s / 2;
+		int x = candidates->cell_x[i] - origin + cand_padding;
+		if (s % 2 && cand_hint(state, s / 2)) {
+			x += candidates->hint_widths[s / 2];
+		}
+		const double *color = i == job->selected_index ?
+			state->config.selection_text_color :
+			state->config.text_color;
+		cairo_set_source_rgba(cairo, color[0], color[1], color[2],
+			color[3]);
+		cairo_move_to(cairo, x + (double)(logical.x - segments[s].x) /
+			PANGO_SCALE, baselines[s % 2]);
+		pango_cairo_show_glyph_item(cairo, row, run);
+	} while (pango_layout_iter_next_run(iter));
+	pango_layout_iter_free(iter);
+
+	g_object_unref(layout);
+	pango_attr_list_unref(attrs);
+	free(segments);
+	free(row);
+}
+
+// runs on the worker, returns false if given up
+static bool render_job(struct wlchewing_render_worker *worker,
+		struct wlchewing_render_job *job) {
+	struct wlchewing_state *state = worker->state;
+	cairo_t *cairo = job->buffer->cairo;
+	// cells carry their background, only the rest is painted here
 	cairo_save(cairo);
-	cairo_set_source_rgba(cairo, state->config.background_color[0],
-		state->config.background_color[1],
-		state->config.background_color[2],
-		state->config.background_color[3]);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cairo);
-	cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
 
-	cairo_font_options_t *opt = cairo_font_options_create();
-	if (panel->subpixel == WL_OUTPUT_SUBPIXEL_NONE) {
-		cairo_font_options_set_antialias(opt, CAIRO_ANTIALIAS_GRAY);
-	} else {
-		cairo_font_options_set_antialias(opt, CAIRO_ANTIALIAS_SUBPIXEL);
-		cairo_font_options_set_subpixel_order(opt,
-			buffer_subpixel_to_cairo[panel->subpixel]);
-	}
-	cairo_set_font_options(cairo, opt);
-	cairo_font_options_destroy(opt);
-	pango_cairo_update_layout(cairo, state->bottom_panel_text_layout);
-	pango_cairo_update_layout(cairo, state->bottom_panel_key_hint_layout);
-
-	int offset = 0, total_offset = 0;
-	for (int i = 0; i < total - state->bottom_panel->selected_index &&
-			total_offset < pool->width; i++) {
-		cairo_translate(cairo, offset, 0);
-		offset = render_cand(state, buffer,
-			chewing_cand_string_by_index_static(state->chewing,
-				i + panel->selected_index), i);
-		total_offset += offset;
+	struct wlchewing_candidates *candidates = job->candidates;
+	if (job->strip) {
+		// every page of the tile side by side, never drawn again
+		render_background(state, cairo);
+		int tile_x = candidates_tile_x(candidates, job->tile);
+		for (int p = candidates->tile_starts[job->tile];
+				p < candidates->tile_starts[job->tile + 1]; p++) {
+			int start = candidates_page_start(candidates, p);
+			int end = candidates_page_end(candidates, p);
+			if (state->config.renderer == RENDERER_ROW) {
+				cairo_save(cairo);
+				cairo_translate(cairo,
+					candidates->cell_x[start] - tile_x, 0);
+				render_row(worker, cairo, job, start, end);
+				cairo_restore(cairo);
+				continue;
+			}
+			for (int i = start; i < end; i++) {
+				(state->config.renderer == RENDERER_GLYPH ?
+					glyph_cand : blit_cand)(worker, cairo,
+					job, i, i - start,
+					candidates->cell_x[i] - tile_x);
+			}
+		}
+		cairo_restore(cairo);
+		return true;
+	}
+	int page = candidates_page_of(candidates, job->selected_index);
+	int start = candidates_page_start(candidates, page);
+	int end = candidates_page_end(candidates, page);
+	int origin = candidates->cell_x[start];
+	if (state->config.renderer == RENDERER_ROW) {
+		if (job->repaint[0] >= 0) {
+			// the row is shaped as a whole anyway, only paint the
+			// two cells
+			for (int r = 0; r < 2; r++) {
+				int i = job->repaint[r];
+				cairo_rectangle(cairo, candidates->cell_x[i] - origin,
+					0, candidates_cell_width(candidates, i),
+					job->height);
+			}
+			cairo_clip(cairo);
+		}
+		render_background(state, cairo);
+		render_row(worker, cairo, job, start, end);
+		cairo_restore(cairo);
+		return true;
+	}
+	if (job->repaint[0] >= 0) {
+		// same page, only the selection moved
+		for (int r = 0; r < 2; r++) {
+			int i = job->repaint[r];
+			if (r && i == job->repaint[0]) {
+				break;
+			}
+			(state->config.renderer == RENDERER_GLYPH ?
+				glyph_cand : blit_cand)(worker, cairo, job, i,
+				i - start, candidates->cell_x[i] - origin);
+		}
+		cairo_restore(cairo);
+		return true;
+	}
+
+	render_background(state, cairo);
+	for (int i = start; i < end; i++) {
+		if (atomic_load(&worker->generation) != job->generation) {
+			// selection moved on, frame will be dropped anyway
+			cairo_restore(cairo);
+			return false;
+		}
+		(state->config.renderer == RENDERER_GLYPH ?
+			glyph_cand : blit_cand)(worker, cairo, job, i,
+			i - start, candidates->cell_x[i] - origin);
 	}
 	cairo_restore(cairo);
+	return true;
+}
+
+static void *render_worker_run(void *data) {
+	struct wlchewing_render_worker *worker = data;
+	pthread_mutex_lock(&worker->lock);
+	while (true) {
+		while (!worker->stop && !worker->has_job) {
+			pthread_cond_wait(&worker->cond, &worker->lock);
+		}
+		if (worker->stop) {
+			break;
+		}
+		struct wlchewing_render_job job = worker->job;
+		worker->has_job = false;
+		pthread_mutex_unlock(&worker->lock);
+
+		if (job.layout) {
+			// even if the frame turns out stale
+			(worker->state->config.renderer == RENDERER_ROW ?
+				candidates_measure_row : candidates_measure)(
+				job.candidates, worker->layout_cache,
+				job.scale, job.subpixel,
+				worker->state->config.key_hint);
+			candidates_partition(job.candidates, job.width,
+				cand_padding);
+			if (job.strip) {
+				candidates_tile(job.candidates,
+					strip_tile_size * scale_unit /
+					job.scale);
+			}
+		}
+		job.complete = job.buffer && atomic_load(&worker->generation) ==
+			job.generation && render_job(worker, &job);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->done = job;
+		worker->has_done = true;
+		pthread_cond_broadcast(&worker->cond);
+		uint64_t one = 1;
+		if (write(worker->event_fd, &one, sizeof(one)) < 0 &&
+				errno != EAGAIN) {
+			wlchewing_perr("Failed to notify rendered frame");
+		}
+	}
+	pthread_mutex_unlock(&worker->lock);
+	return NULL;
+}
+
+static void render_submit(struct wlchewing_state *state);
+
+static void frame_done(void *data, struct wl_callback *callback,
+		uint32_t callback_data) {
+	struct wlchewing_bottom_panel *panel = data;
+	wl_callback_destroy(callback);
+	panel->frame_callback = NULL;
+	if (panel->shown && panel->configured && !panel->rendering &&
+			panel->submitted_generation != panel->generation) {
+		render_submit(panel->state);
+	}
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done	= frame_done,
+};
+
+// with --offload, over the cell of index on its page, applied on next commit
+// of wl_surface
+static void place_highlight(struct wlchewing_bottom_panel *panel,
+		struct wlchewing_candidates *candidates, int index,
+		uint32_t height) {
+	int origin = candidates->cell_x[candidates_page_start(candidates,
+		candidates_page_of(candidates, index))];
+	wl_subsurface_set_position(panel->highlight_subsurface,
+		candidates->cell_x[index] - origin, 0);
+	wp_viewport_set_destination(panel->highlight_viewport,
+		candidates_cell_width(candidates, index), height);
+	wl_surface_commit(panel->highlight_surface);
+}
+
+// with --offload, the single pixel stretched over the panel
+static void show_background(struct wlchewing_bottom_panel *panel) {
+	if (!panel->background_attached) {
+		wl_surface_attach(panel->wl_surface, panel->background_buffer,
+			0, 0);
+		wl_surface_damage_buffer(panel->wl_surface, 0, 0, 1, 1);
+		panel->background_attached = true;
+	}
+}
+
+// on first frame, a configure or preferred_buffer_scale changes
+static void resize(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	zwlr_layer_surface_v1_set_exclusive_zone(panel->layer_surface,
+		state->config.dock == DOCK_DOCK ? panel->height :
+		state->config.dock == DOCK_YEILD ? 0 : -1);
+	if (panel->viewport) {
+		wp_viewport_set_destination(panel->viewport, panel->width,
+			panel->height);
+	}
+	if (panel->text_viewport) {
+		// set again for each page with --strip
+		wp_viewport_set_destination(panel->text_viewport,
+			panel->width, panel->height);
+	}
+	struct wl_surface *surface = state->config.offload ?
+		panel->text_surface : panel->wl_surface;
+	if (!(state->config.offload ? panel->text_viewport :
+			panel->viewport)) {
+		// buffers are in device pixels otherwise
+		wl_surface_set_buffer_scale(surface,
+			panel->scale / scale_unit);
+	}
+}
+
+// with --offload, candidates presented are all still right if only the
+// highlight moves, unless the selected one is in another color
+static bool highlight_only(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	struct wlchewing_candidates *candidates = panel->candidates;
+	if (!state->config.offload || !panel->laid_out ||
+			panel->presented_page_serial != panel->page_serial ||
+			!panel->background_attached ||
+			panel->presented_height != panel->height ||
+			candidates->partitioned_width != panel->width ||
+			candidates->scale != panel->scale ||
+			memcmp(state->config.text_color,
+				state->config.selection_text_color,
+				sizeof(state->config.text_color))) {
+		return false;
+	}
+	return candidates_page_of(candidates, panel->presented_index) ==
+		candidates_page_of(candidates, panel->selected_index);
+}
+
+static void submit_job(struct wlchewing_state *state,
+		struct wlchewing_render_job job) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	struct wlchewing_render_worker *worker = state->render_worker;
+	panel->submitted_generation = panel->generation;
+	pthread_mutex_lock(&worker->lock);
+	worker->job = job;
+	worker->has_job = true;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+	panel->rendering = true;
+}
+
+// scrolls to the page of the selection on a tile already drawn
+static void strip_present(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	struct wlchewing_strip *strip = panel->strip;
+	struct wlchewing_candidates *candidates = panel->candidates;
+	int page = candidates_page_of(candidates, panel->selected_index);
+	int tile = candidates_tile_of(candidates, page);
+	int start = candidates_page_start(candidates, page);
+	int end = candidates_page_end(candidates, page);
+	int tile_x = candidates_tile_x(candidates, tile);
+	int width = candidates->cell_x[end] - candidates->cell_x[start];
 
-	wl_surface_attach(panel->wl_surface, buffer->wl_buffer, 0, 0);
-	wl_surface_damage_buffer(panel->wl_surface, 0, 0,
-		pool->width * pool->scale, pool->height * pool->scale);
+	panel->submitted_generation = panel->generation;
+	panel->frame_callback = wl_surface_frame(panel->wl_surface);
+	wl_callback_add_listener(panel->frame_callback, &frame_listener, panel);
+	if (strip->attached != tile) {
+		struct wlchewing_buffer *buffer = strip->tiles[tile];
+		wl_surface_attach(panel->text_surface, buffer->wl_buffer, 0, 0);
+		wl_surface_damage_buffer(panel->text_surface, 0, 0, INT32_MAX,
+			INT32_MAX);
+		strip->attached = tile;
+	}
+	// the page may be narrower than the panel, not beyond the tile, in
+	// buffer pixels as tiles are in device pixels
+	int x0 = scale_pixels(candidates->cell_x[start] - tile_x, strip->scale);
+	int x1 = scale_pixels(candidates->cell_x[end] - tile_x, strip->scale);
+	wp_viewport_set_source(panel->text_viewport, wl_fixed_from_int(x0), 0,
+		wl_fixed_from_int(x1 - x0), wl_fixed_from_int(
+		scale_pixels(strip->height, strip->scale)));
+	wp_viewport_set_destination(panel->text_viewport, width, strip->height);
+	place_highlight(panel, candidates, panel->selected_index,
+		strip->height);
+	wl_surface_commit(panel->text_surface);
+	show_background(panel);
 	wl_surface_commit(panel->wl_surface);
-	wl_display_roundtrip(state->display);
+	if (panel->retired_tile) {
+		buffer_destroy(panel->retired_tile);
+		panel->retired_tile = NULL;
+	}
+	panel->presented_page_serial = panel->page_serial;
+	panel->presented_index = panel->selected_index;
+	panel->presented_height = strip->height;
+}
 
-	// a configure or preferred_buffer_scale changes
-	if (panel->width != pool->width || panel->height != pool->height ||
-			panel->scale != pool->scale) {
-		buffer_pool_destroy(state->bottom_panel->buffer_pool);
+// with --strip, the worker only draws each tile the first time it is shown
+static void strip_submit(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	struct wlchewing_candidates *candidates = panel->candidates;
+	struct wlchewing_render_job job = {
+		.generation = panel->generation,
+		.width = panel->width,
+		.height = panel->height,
+		.scale = panel->scale,
+		// always over a transparent buffer
+		.subpixel = WL_OUTPUT_SUBPIXEL_NONE,
+		.candidates = candidates,
+		.selected_index = panel->selected_index,
+		.repaint = {-1, -1},
+		.strip = true,
+	};
+	if (!panel->laid_out || candidates->scale != panel->scale ||
+			candidates->subpixel != job.subpixel) {
+		// tiles follow the pages, known once the worker is back
+		panel->laid_out = false;
+		job.layout = true;
+		job.page_serial = ++panel->page_serial;
+		job.tile = -1;
+		submit_job(state, job);
+		return;
+	}
+	if (candidates->partitioned_width != panel->width) {
+		candidates_partition(candidates, panel->width, cand_padding);
+		candidates_tile(candidates,
+			strip_tile_size * scale_unit / panel->scale);
+		panel->page_serial++;
+	}
+
+	struct wlchewing_strip *strip = panel->strip;
+	if (strip && (strip->page_serial != panel->page_serial ||
+			strip->height != panel->height ||
+			strip->scale != panel->scale)) {
+		strip_destroy(panel);
+		strip = NULL;
+	}
+	if (!strip) {
+		strip = panel->strip = xcalloc(1, sizeof(struct wlchewing_strip));
+		strip->page_serial = panel->page_serial;
+		strip->height = panel->height;
+		strip->scale = panel->scale;
+		strip->tile_count = candidates->tile_count;
+		strip->tiles = xcalloc(strip->tile_count,
+			sizeof(struct wlchewing_buffer *));
+		strip->drawn = xcalloc(strip->tile_count, sizeof(bool));
+		strip->attached = -1;
+		resize(state);
+	}
+
+	int tile = candidates_tile_of(candidates, candidates_page_of(
+		candidates, panel->selected_index));
+	if (strip->drawn[tile]) {
+		strip_present(state);
+		return;
+	}
+	if (!strip->tiles[tile]) {
+		strip->tiles[tile] = buffer_new(state->wl_globals.shm,
+			candidates_tile_x(candidates, tile + 1) -
+			candidates_tile_x(candidates, tile),
+			strip->height, strip->scale);
+		if (!strip->tiles[tile]) {
+			return;
+		}
+	}
+	job.buffer = strip->tiles[tile];
+	job.page_serial = panel->page_serial;
+	job.tile = tile;
+	submit_job(state, job);
+}
+
+// hands the current candidates to the worker, nothing may be in flight
+static void render_submit(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	if (panel->candidates_stale || !panel->candidates) {
+		// libchewing is not ours to touch from the worker, copy it all
+		if (panel->candidates) {
+			candidates_destroy(panel->candidates);
+		}
+		panel->candidates = candidates_new(state->chewing);
+		panel->candidates_stale = false;
+		panel->laid_out = false;
+		panel->page_serial++;
+	}
+	assert(panel->selected_index < panel->candidates->count);
+
+	if (highlight_only(state)) {
+		place_highlight(panel, panel->candidates, panel->selected_index,
+			panel->height);
+		panel->submitted_generation = panel->generation;
+		panel->frame_callback = wl_surface_frame(panel->wl_surface);
+		wl_callback_add_listener(panel->frame_callback,
+			&frame_listener, panel);
+		wl_surface_commit(panel->wl_surface);
+		panel->presented_index = panel->selected_index;
+		return;
+	}
+	if (state->config.strip) {
+		strip_submit(state);
+		return;
+	}
 
-		zwlr_layer_surface_v1_set_exclusive_zone(panel->layer_surface,
-			state->config.dock == DOCK_DOCK ? panel->height :
-			state->config.dock == DOCK_YEILD ? 0 : -1);
-		wl_surface_set_buffer_scale(panel->wl_surface, panel->scale);
-		state->bottom_panel->buffer_pool = buffer_pool_new(
+	struct wlchewing_buffer_pool *pool = panel->buffer_pool;
+	if (!pool || panel->width != pool->width ||
+			panel->height != pool->height ||
+			panel->scale != pool->scale) {
+		if (pool) {
+			buffer_pool_destroy(pool);
+		}
+		resize(state);
+		pool = panel->buffer_pool = buffer_pool_new(
 			state->wl_globals.shm,
 			panel->width, panel->height, panel->scale);
-		bottom_panel_render(state);
 	}
+	struct wlchewing_buffer *buffer = buffer_pool_get_buffer(pool);
+	if (!buffer) {
+		return;
+	}
+
+	// text on a transparent buffer cannot know what is blended under it
+	const int32_t subpixel = state->config.offload ?
+		WL_OUTPUT_SUBPIXEL_NONE : panel->subpixel;
+	struct wlchewing_candidates *candidates = panel->candidates;
+	bool layout = !panel->laid_out || candidates->scale != pool->scale ||
+		candidates->subpixel != subpixel;
+	if (layout) {
+		// measured by the worker, hands off until it is back
+		panel->laid_out = false;
+		panel->page_serial++;
+	} else if (candidates->partitioned_width != pool->width) {
+		candidates_partition(candidates, pool->width, cand_padding);
+		panel->page_serial++;
+	}
+	bool partial = panel->laid_out && buffer->presented &&
+		buffer->page_serial == panel->page_serial &&
+		candidates_page_of(candidates, buffer->selected_index) ==
+		candidates_page_of(candidates, panel->selected_index);
+
+	submit_job(state, (struct wlchewing_render_job) {
+		.generation = panel->generation,
+		.buffer = buffer,
+		.width = pool->width,
+		.height = pool->height,
+		.scale = pool->scale,
+		.subpixel = subpixel,
+		.candidates = candidates,
+		.layout = layout,
+		.page_serial = panel->page_serial,
+		.selected_index = panel->selected_index,
+		.repaint = {
+			partial ? buffer->selected_index : -1,
+			partial ? panel->selected_index : -1,
+		},
+	});
+}
+
+void bottom_panel_render(struct wlchewing_state *state) {
+	struct wlchewing_bottom_panel *panel = state->bottom_panel;
+	panel->generation++;
+	atomic_store(&state->render_worker->generation, panel->generation);
+	if (panel->rendering || !panel->configured || panel->frame_callback) {
+		// submitted once the frame in flight comes back, on configure,
+		// or on next frame
+		return;
+	}
+	render_submit(state);
+}
+
+void bottom_panel_handle_rendered(struct wlchewing_state *state) {
+	struct wlchewing_render_worker *worker = state->render_worker;
+	uint64_t count;
+	if (read(worker->event_fd, &count, sizeof(count)) < 0 &&
+			errno != EAGAIN) {
+		wlchewing_perr("Failed to read from eventfd");
+	}
+	pthread_mutex_lock(&worker->lock);
+	if (!worker->has_done) {
+		// already taken by bottom_panel_destroy
+		pthread_mutex_unlock(&worker->lock);
+		return;
+	}
+	struct wlchewing_render_job job = worker->done;
+	worker->has_done = false;
+	pthread_mutex_unlock(&worker->lock);
+
+	struct wlchewing_bottom_panel *panel = state->persistent_bottom_panel;
+	panel->rendering = false;
+	if (job.layout) {
+		panel->laid_out = true;
+	}
+	if (job.strip) {
+		// drawn for good, presented from there
+		if (job.complete && job.tile >= 0) {
+			assert(panel->strip &&
+				panel->strip->page_serial == job.page_serial);
+			panel->strip->drawn[job.tile] = true;
+		}
+		if (panel->shown && panel->configured &&
+				!panel->frame_callback) {
+			render_submit(state);
+		}
+		return;
+	}
+	bool full = job.repaint[0] < 0;
+	struct wlchewing_buffer *buffer = job.buffer;
+	if (job.complete) {
+		buffer->page_serial = job.page_serial;
+		buffer->selected_index = job.selected_index;
+	} else {
+		// partly painted
+		buffer->presented = false;
+	}
+	if (job.generation != panel->generation) {
+		// stale, render the latest instead if still shown
+		buffer->available = true;
+		if (panel->shown && panel->configured &&
+				!panel->frame_callback) {
+			render_submit(state);
+		}
+		return;
+	}
+
+	struct wlchewing_buffer_pool *pool = panel->buffer_pool;
+	struct wl_surface *surface = state->config.offload ?
+		panel->text_surface : panel->wl_surface;
+	panel->frame_callback = wl_surface_frame(panel->wl_surface);
+	wl_callback_add_listener(panel->frame_callback, &frame_listener, panel);
+	wl_surface_attach(surface, buffer->wl_buffer, 0, 0);
+	struct wlchewing_candidates *candidates = job.candidates;
+	int page = candidates_page_of(candidates, job.selected_index);
+	if (full || panel->presented_page_serial != job.page_serial ||
+			candidates_page_of(candidates, panel->presented_index) !=
+			page) {
+		wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
+	} else {
+		int origin = candidates->cell_x[
+			candidates_page_start(candidates, page)];
+		int cells[2] = {panel->presented_index, job.selected_index};
+		for (int r = 0; r < 2; r++) {
+			// a pixel more each side for rounding
+			int x0 = scale_pixels(candidates->cell_x[cells[r]] -
+				origin, pool->scale) - 1;
+			int x1 = scale_pixels(candidates->cell_x[cells[r] + 1] -
+				origin, pool->scale) + 1;
+			wl_surface_damage_buffer(surface, x0, 0, x1 - x0,
+				INT32_MAX);
+		}
+	}
+	if (state->config.offload) {
+		// subsurfaces are synchronized, all shown with wl_surface
+		place_highlight(panel, candidates, job.selected_index,
+			pool->height);
+		wl_surface_commit(panel->text_surface);
+		show_background(panel);
+	}
+	wl_surface_commit(panel->wl_surface);
+	buffer->presented = true;
+	panel->presented_page_serial = job.page_serial;
+	panel->presented_index = job.selected_index;
+	panel->presented_height = pool->height;
+}
+
+void bottom_panel_benchmark(struct wlchewing_state *state, FILE *f) {
+	bottom_panel_init(state);
+	struct wlchewing_render_worker *worker = state->render_worker;
+
+	// characters of the sample and pairs of them
+	const char *sample = pango_language_get_sample_string(
+		pango_language_from_string("zh-tw"));
+	size_t sample_len = strlen(sample);
+	char *texts = xcalloc(sample_len * 6, 1), *out = texts;
+	const char **strings = xcalloc(sample_len * 2, sizeof(const char *));
+	int count = 0;
+	for (int length = 1; length <= 2; length++) {
+		for (const char *p = sample; *p; ) {
+			const char *q = p;
+			int chars = 0;
+			for (; chars < length && *q; chars++) {
+				do {
+					q++;
+				} while ((*q & 0xc0) == 0x80);
+			}
+			if (chars < length) {
+				break;
+			}
+			strings[count++] = out;
+			memcpy(out, p, q - p);
+			out += q - p + 1;
+			do {
+				p++;
+			} while ((*p & 0xc0) == 0x80);
+		}
+	}
+
+	const uint32_t width = 1920, height = state->bottom_panel_text_height;
+	cairo_surface_t *surface = cairo_image_surface_create(
+		CAIRO_FORMAT_ARGB32, width, height);
+	// only its cairo is drawn to
+	struct wlchewing_buffer buffer = {
+		.cairo = cairo_create(surface),
+	};
+
+	// the worker is idle, jobs are run here
+	static const struct {
+		enum renderer_option renderer;
+		const char *name;
+	} renderers[] = {
+		{RENDERER_CELL, "cell"},
+		{RENDERER_ROW, "row"},
+		{RENDERER_GLYPH, "glyph"},
+	};
+	enum renderer_option configured = state->config.renderer;
+	for (size_t r = 0; r < sizeof(renderers) / sizeof(renderers[0]); r++) {
+		state->config.renderer = renderers[r].renderer;
+		struct wlchewing_candidates *candidates =
+			candidates_new_from_strings(strings, count);
+		uint64_t since = stats_now_us();
+		(renderers[r].renderer == RENDERER_ROW ?
+			candidates_measure_row : candidates_measure)(
+			candidates, worker->layout_cache, scale_unit,
+			WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB,
+			state->config.key_hint);
+		candidates_partition(candidates, width, cand_padding);
+		uint64_t measure_us = stats_now_us() - since;
+
+		int page_end = candidates_page_end(candidates, 0);
+		since = stats_now_us();
+		for (int i = 0; i < state->config.benchmark_frames; i++) {
+			struct wlchewing_render_job job = {
+				.generation = atomic_load(&worker->generation),
+				.buffer = &buffer,
+				.width = width,
+				.height = height,
+				.scale = scale_unit,
+				.subpixel = WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB,
+				.candidates = candidates,
+				.selected_index = i % page_end,
+				.repaint = {-1, -1},
+			};
+			render_job(worker, &job);
+		}
+		uint64_t render_us = stats_now_us() - since;
+		fprintf(f, "%-8s measure %8" PRIu64 "us frame avg %8.1fus "
+			"(%d candidates, %d on page)\n", renderers[r].name,
+			measure_us,
+			(double)render_us / state->config.benchmark_frames,
+			count, page_end);
+		candidates_destroy(candidates);
+	}
+	state->config.renderer = configured;
+
+	cairo_destroy(buffer.cairo);
+	cairo_surface_destroy(surface);
+	free(strings);
+	free(texts);
+	bottom_panel_finish(state);
 }
@@ -1,27 +1,145 @@
 #ifndef BOTTOM_PANEL_H
 #define BOTTOM_PANEL_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "candidates.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "wlr-layer-shell-unstable-v1-client-protocol.h"
 
 struct wlchewing_state;
 
+// what the render worker needs to paint a frame
+struct wlchewing_render_job {
+	uint64_t generation;
+	struct wlchewing_buffer *buffer;
+	uint32_t width, height;
+	int32_t scale, subpixel;
+	// not touched by the main thread until the job comes back
+	struct wlchewing_candidates *candidates;
+	bool layout; // measure and partition candidates first
+	uint64_t page_serial;
+	int selected_index;
+	// cells to repaint, both -1 for a full frame
+	int repaint[2];
+	// with --strip, buffer is the tile drawn instead of the page, and
+	// without buffer only layout is done
+	bool strip;
+	int tile;
+	bool complete;
+};
+
+// with --strip, every page drawn once side by side into tiles, scrolled by
+// the viewport of text_surface
+struct wlchewing_strip {
+	uint64_t page_serial; // drawn for
+	uint32_t height;
+	int32_t scale;
+	int tile_count;
+	struct wlchewing_buffer **tiles; // NULL until first shown
+	bool *drawn;
+	int attached; // tile on text_surface, -1 if none
+};
+
+struct wlchewing_render_worker {
+	struct wlchewing_state *state; // for config only
+	struct wlchewing_layout_cache *layout_cache;
+	struct wlchewing_cell_cache *cell_cache;
+	struct wlchewing_glyph_atlas *glyph_atlas;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct wlchewing_render_job job, done;
+	bool has_job, has_done, stop;
+	int event_fd; // rendered frame ready
+	// latest requested, frames of others are stale
+	_Atomic uint64_t generation;
+};
+
 struct wlchewing_bottom_panel {
+	struct wlchewing_state *state;
 	struct zwlr_layer_surface_v1 *layer_surface;
 	struct wl_surface *wl_surface;
 	struct wlchewing_buffer_pool *buffer_pool;
+	// with fractional scales, buffers are in device pixels, shown at the
+	// surface size by viewports
+	struct wp_fractional_scale_v1 *fractional_scale;
+
+	// with --offload, wl_surface shows a single pixel background, and
+	// the highlight and the candidates are subsurfaces above it
+	struct wp_viewport *viewport; // also with fractional scales
+	struct wl_buffer *background_buffer;
+	bool background_attached; // since last unmapped
+	struct wl_surface *highlight_surface;
+	struct wl_subsurface *highlight_subsurface;
+	struct wp_viewport *highlight_viewport;
+	struct wl_buffer *highlight_buffer;
+	struct wl_surface *text_surface; // buffers go here
+	struct wl_subsurface *text_subsurface;
+	// with --strip, or fractional scales and --offload
+	struct wp_viewport *text_viewport;
+	struct wlchewing_strip *strip;
+	// of a strip dropped while still attached, freed on next attach
+	struct wlchewing_buffer *retired_tile;
 
 	uint32_t width, height;
-	int32_t scale;
+	int32_t scale; // in scale_unit
 	int32_t subpixel;
 	int selected_index;
+	// copied on open, rebuilt on next submit when stale
+	struct wlchewing_candidates *candidates;
+	bool candidates_stale;
+	// candidates measured and partitioned, false while the worker does it
+	bool laid_out;
+	uint64_t page_serial; // bumped when pages change
+	uint64_t presented_page_serial;
+	int presented_index;
+	uint32_t presented_height;
+
+	uint64_t generation; // bumped on every render request
+	uint64_t submitted_generation;
+	bool rendering; // a frame is with the worker
+	// renders wait for it, so that requests between frames collapse
+	struct wl_callback *frame_callback;
+	bool configured; // since last unmapped
+	bool shown;
 };
 
 int bottom_panel_init(struct wlchewing_state *state);
 
-struct wlchewing_bottom_panel *bottom_panel_new(struct wlchewing_state *state);
+// creates the surface ahead of time, kept until compositor closes it
+void bottom_panel_prepare(struct wlchewing_state *state);
+
+struct wlchewing_bottom_panel *bottom_panel_open(struct wlchewing_state *state);
+
+// unmaps, surface and buffers are kept for the next open
+void bottom_panel_close(struct wlchewing_bottom_panel *panel);
+
+// the candidate list changed, copied again on next render
+void bottom_panel_candidates_changed(struct wlchewing_bottom_panel *panel);
 
 void bottom_panel_destroy(struct wlchewing_bottom_panel *panel);
 
+// first candidate on the page of the selection
+int bottom_panel_page_start(struct wlchewing_bottom_panel *panel);
+
+// selection to the start of the page pages away, false if not laid out yet
+bool bottom_panel_move_page(struct wlchewing_bottom_panel *panel, int pages);
+
+// candidate at surface x on the page presented, -1 if none
+int bottom_panel_hit_test(struct wlchewing_bottom_panel *panel, double x);
+
 void bottom_panel_render(struct wlchewing_state *state);
 
+// takes a frame rendered by the worker and commits it if still current
+void bottom_panel_handle_rendered(struct wlchewing_state *state);
+
+void bottom_panel_finish(struct wlchewing_state *state);
+
+// draws frames of sample candidates with each renderer, needs no compositor
+void bottom_panel_benchmark(struct wlchewing_state *state, FILE *f);
+
 #endif
@@ -21,7 +21,7 @@ static const struct wl_buffer_listener buffer_listener = {
 };
 
 struct wlchewing_buffer *buffer_new(struct wl_shm *shm,
-		uint32_t width, uint32_t height, uint32_t scale) {
+		uint32_t width, uint32_t height, int32_t scale) {
 	struct wlchewing_buffer *buffer = xcalloc(1, sizeof(struct wlchewing_buffer));
 	buffer->available = true;
 
@@ -32,7 +32,8 @@ struct wlchewing_buffer *buffer_new(struct wl_shm *shm,
 		return NULL;
 	}
 
-	uint32_t widthpx = width * scale, heightpx = height * scale;
+	uint32_t widthpx = scale_pixels(width, scale);
+	uint32_t heightpx = scale_pixels(height, scale);
 	off_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, widthpx);
 	buffer->size = heightpx * stride;
 	int ret = ftruncate(fd, buffer->size);
@@ -61,7 +62,8 @@ struct wlchewing_buffer *buffer_new(struct wl_shm *shm,
 		buffer->data, CAIRO_FORMAT_ARGB32, widthpx, heightpx, stride);
 	buffer->cairo = cairo_create(surface);
 	cairo_surface_destroy(surface);
-	cairo_scale(buffer->cairo, scale, scale);
+	cairo_scale(buffer->cairo, (double)scale / scale_unit,
+		(double)scale / scale_unit);
 	return buffer;
 }
 
@@ -73,7 +75,7 @@ void buffer_destroy(struct wlchewing_buffer *buffer) {
 }
 
 struct wlchewing_buffer_pool *buffer_pool_new(struct wl_shm *shm,
-		uint32_t width, uint32_t height, uint32_t scale) {
+		uint32_t width, uint32_t height, int32_t scale) {
 	struct wlchewing_buffer_pool *pool = xcalloc(1, sizeof(struct wlchewing_buffer_pool));
 	pool->shm = shm;
 	pool->width = width;
@@ -5,6 +5,15 @@
 #include <sys/types.h>
 #include <wayland-client.h>
 
+// scales are in 120ths, as wp_fractional_scale_v1 sends them
+static constexpr int32_t scale_unit = 120;
+
+// device pixels of size surface pixels, rounded as wp_fractional_scale_v1
+// suggests
+static inline int32_t scale_pixels(int32_t size, int32_t scale) {
+	return ((int64_t)size * scale + scale_unit / 2) / scale_unit;
+}
+
 struct wlchewing_buffer {
 	void *data;
 	off_t size;
@@ -12,6 +21,12 @@ struct wlchewing_buffer {
 	cairo_t *cairo;
 	bool available;
 
+	// content is known, as last painted whole and presented
+	bool presented;
+	// what it shows, for repainting only what changed
+	uint64_t page_serial;
+	int selected_index;
+
 	struct wl_list link;
 };
 
@@ -25,13 +40,13 @@ struct wlchewing_buffer_pool {
 };
 
 struct wlchewing_buffer *buffer_new(struct wl_shm *shm,
-	uint32_t width, uint32_t height, uint32_t scale);
+	uint32_t width, uint32_t height, int32_t scale);
 
 void buffer_destroy(struct wlchewing_buffer *buffer);
 
 
 struct wlchewing_buffer_pool *buffer_pool_new(struct wl_shm *shm,
-	uint32_t width, uint32_t height, uint32_t scale);
+	uint32_t width, uint32_t height, int32_t scale);
 
 struct wlchewing_buffer *buffer_pool_get_buffer(struct wlchewing_buffer_pool *pool);
 
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "candidates.h"
+#include "xmem.h"
+
+struct wlchewing_candidates *candidates_new(ChewingContext *chewing) {
+	int count = chewing_cand_TotalChoice(chewing);
+	const char **strings = xcalloc(count, sizeof(const char *));
+	for (int i = 0; i < count; i++) {
+		strings[i] = chewing_cand_string_by_index_static(chewing, i);
+	}
+	struct wlchewing_candidates *candidates =
+		candidates_new_from_strings(strings, count);
+	free(strings);
+	return candidates;
+}
+
+struct wlchewing_candidates *candidates_new_from_strings(
+		const char *const *strings, int count) {
+	struct wlchewing_candidates *candidates = xcalloc(1,
+		sizeof(struct wlchewing_candidates));
+	candidates->count = count;
+	candidates->offsets = xcalloc(count + 1, sizeof(uint32_t));
+	for (int i = 0; i < count; i++) {
+		candidates->offsets[i + 1] = candidates->offsets[i] +
+			strlen(strings[i]) + 1;
+	}
+	candidates->arena = xcalloc(candidates->offsets[count] + 1, 1);
+	for (int i = 0; i < count; i++) {
+		strcpy(&candidates->arena[candidates->offsets[i]], strings[i]);
+	}
+	candidates->text_widths = xcalloc(count + 1, sizeof(int));
+	candidates->cell_x = xcalloc(count + 1, sizeof(int));
+	candidates->page_starts = xcalloc(count + 1, sizeof(int));
+	candidates->tile_starts = xcalloc(count + 1, sizeof(int));
+	return candidates;
+}
+
+void candidates_destroy(struct wlchewing_candidates *candidates) {
+	free(candidates->arena);
+	free(candidates->offsets);
+	free(candidates->text_widths);
+	free(candidates->cell_x);
+	free(candidates->page_starts);
+	free(candidates->tile_starts);
+	free(candidates);
+}
+
+void candidates_measure(struct wlchewing_candidates *candidates,
+		struct wlchewing_layout_cache *layout_cache, int32_t scale,
+		int32_t subpixel, bool key_hint) {
+	for (int i = 0; key_hint && i < 10; i++) {
+		char hint[2] = {i == 9 ? '0' : '1' + i, 0};
+		candidates->hint_widths[i] = layout_cache_get(layout_cache,
+			LAYOUT_KEY_HINT, hint, scale, subpixel)->width;
+	}
+	for (int i = 0; i < candidates->count; i++) {
+		candidates->text_widths[i] = layout_cache_get(layout_cache,
+			LAYOUT_TEXT, candidates_get(candidates, i), scale,
+			subpixel)->width;
+	}
+	candidates->scale = scale;
+	candidates->subpixel = subpixel;
+	candidates->measured = true;
+}
+
+void candidates_measure_row(struct wlchewing_candidates *candidates,
+		struct wlchewing_layout_cache *layout_cache, int32_t scale,
+		int32_t subpixel, bool key_hint) {
+	// hints first, as scaled runs, then the arena with tabs for nuls
+	static constexpr char hints[] = "1234567890\t";
+	const size_t hints_len = key_hint ? strlen(hints) : 0;
+	const size_t size = hints_len + candidates->offsets[candidates->count];
+	char *row = xcalloc(size + 1, 1);
+	memcpy(row, hints, hints_len);
+	memcpy(row + hints_len, candidates->arena,
+		candidates->offsets[candidates->count]);
+	for (size_t i = hints_len; i < size; i++) {
+		if (!row[i]) {
+			row[i] = '\t';
+		}
+	}
+
+	PangoLayout *layout = layout_cache_layout(layout_cache, LAYOUT_TEXT,
+		scale, subpixel);
+	PangoAttrList *attrs = pango_attr_list_new();
+	if (key_hint) {
+		PangoAttribute *attr = pango_attr_scale_new(0.75);
+		attr->start_index = 0;
+		attr->end_index = 10;
+		pango_attr_list_insert(attrs, attr);
+	}
+	pango_layout_set_attributes(layout, attrs);
+	pango_attr_list_unref(attrs);
+	pango_layout_set_text(layout, row, size);
+
+	PangoRectangle from, to;
+	for (int i = 0; i < 10 && key_hint; i++) {
+		pango_layout_index_to_pos(layout, i, &from);
+		pango_layout_index_to_pos(layout, i + 1, &to);
+		candidates->hint_widths[i] = PANGO_PIXELS_CEIL(to.x - from.x);
+	}
+	for (int i = 0; i < candidates->count; i++) {
+		// up to the tab standing for the nul
+		pango_layout_index_to_pos(layout,
+			hints_len + candidates->offsets[i], &from);
+		pango_layout_index_to_pos(layout,
+			hints_len + candidates->offsets[i + 1] - 1, &to);
+		candidates->text_widths[i] = PANGO_PIXELS_CEIL(to.x - from.x);
+	}
+	g_object_unref(layout);
+	free(row);
+	candidates->scale = scale;
+	candidates->subpixel = subpixel;
+	candidates->measured = true;
+}
+
+void candidates_partition(struct wlchewing_candidates *candidates,
+		uint32_t width, int padding) {
+	int page = 0, start = 0;
+	candidates->cell_x[0] = 0;
+	candidates->page_starts[0] = 0;
+	for (int i = 0; i < candidates->count; i++) {
+		// hints are numbered from the page start, so is the width
+		int cell_width = candidates->text_widths[i] + padding * 2 +
+			(i - start < 10 ? candidates->hint_widths[i - start] : 0);
+		if (i > start && candidates->cell_x[i] -
+				candidates->cell_x[start] + cell_width > (int)width) {
+			start = i;
+			candidates->page_starts[++page] = i;
+			cell_width = candidates->text_widths[i] + padding * 2 +
+				candidates->hint_widths[0];
+		}
+		candidates->cell_x[i + 1] = candidates->cell_x[i] + cell_width;
+	}
+	candidates->page_count = candidates->count ? page + 1 : 0;
+	candidates->page_starts[candidates->page_count] = candidates->count;
+	candidates->partitioned_width = width;
+}
+
+int candidates_page_of(struct wlchewing_candidates *candidates, int index) {
+	// last page starting at or before index
+	int low = 0, high = candidates->page_count - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (candidates->page_starts[mid] <= index) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+void candidates_tile(struct wlchewing_candidates *candidates,
+		uint32_t width) {
+	int tile = 0, start = 0;
+	candidates->tile_starts[0] = 0;
+	for (int page = 1; page < candidates->page_count; page++) {
+		if (candidates->cell_x[candidates->page_starts[page + 1]] -
+				candidates->cell_x[candidates->page_starts[start]] >
+				(int)width) {
+			start = page;
+			candidates->tile_starts[++tile] = page;
+		}
+	}
+	candidates->tile_count = candidates->page_count ? tile + 1 : 0;
+	candidates->tile_starts[candidates->tile_count] =
+		candidates->page_count;
+}
+
+int candidates_tile_of(struct wlchewing_candidates *candidates, int page) {
+	// last tile starting at or before page
+	int low = 0, high = candidates->tile_count - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (candidates->tile_starts[mid] <= page) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
+
+int candidates_at(struct wlchewing_candidates *candidates, int page, int x) {
+	int start = candidates_page_start(candidates, page);
+	int end = candidates_page_end(candidates, page);
+	x += candidates->cell_x[start];
+	if (x < candidates->cell_x[start] || x >= candidates->cell_x[end]) {
+		return -1;
+	}
+	// last cell starting at or before x
+	int low = start, high = end - 1;
+	while (low < high) {
+		int mid = (low + high + 1) / 2;
+		if (candidates->cell_x[mid] <= x) {
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	return low;
+}
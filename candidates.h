@@ -0,0 +1,91 @@
+#ifndef CANDIDATES_H
+#define CANDIDATES_H
+
+#include <chewing.h>
+#include <stdint.h>
+
+#include "layout-cache.h"
+
+// candidate list copied out of libchewing on open, measured once and
+// partitioned into pages fitting the panel width
+struct wlchewing_candidates {
+	char *arena; // all strings, nul terminated
+	uint32_t *offsets; // of each string in arena
+	int count;
+
+	bool measured;
+	int32_t scale, subpixel; // measured for
+	int *text_widths;
+	int hint_widths[10]; // 0 without key hints
+
+	uint32_t partitioned_width; // 0 if not partitioned
+	// prefix sums of cell widths, count + 1 of them, a page is drawn
+	// from the cell_x of its start
+	int *cell_x;
+	int *page_starts; // page_count + 1 of them, the last is count
+	int page_count;
+	// pages drawn together with --strip, tile_count + 1 of them
+	int *tile_starts;
+	int tile_count;
+};
+
+struct wlchewing_candidates *candidates_new(ChewingContext *chewing);
+
+struct wlchewing_candidates *candidates_new_from_strings(
+	const char *const *strings, int count);
+
+void candidates_destroy(struct wlchewing_candidates *candidates);
+
+static inline const char *candidates_get(
+		struct wlchewing_candidates *candidates, int index) {
+	return &candidates->arena[candidates->offsets[index]];
+}
+
+// by whoever owns the layout cache, again when scale or subpixel changes
+void candidates_measure(struct wlchewing_candidates *candidates,
+	struct wlchewing_layout_cache *layout_cache, int32_t scale,
+	int32_t subpixel, bool key_hint);
+
+// the same, shaping them all as one row, widths taken from glyph clusters
+void candidates_measure_row(struct wlchewing_candidates *candidates,
+	struct wlchewing_layout_cache *layout_cache, int32_t scale,
+	int32_t subpixel, bool key_hint);
+
+// fills pages greedily, at least a cell each, needs measure
+void candidates_partition(struct wlchewing_candidates *candidates,
+	uint32_t width, int padding);
+
+// below need a partition
+int candidates_page_of(struct wlchewing_candidates *candidates, int index);
+
+static inline int candidates_page_start(
+		struct wlchewing_candidates *candidates, int page) {
+	return candidates->page_starts[page];
+}
+
+static inline int candidates_page_end(
+		struct wlchewing_candidates *candidates, int page) {
+	return candidates->page_starts[page + 1];
+}
+
+static inline int candidates_cell_width(
+		struct wlchewing_candidates *candidates, int index) {
+	return candidates->cell_x[index + 1] - candidates->cell_x[index];
+}
+
+// groups pages into tiles no wider than width, at least a page each
+void candidates_tile(struct wlchewing_candidates *candidates, uint32_t width);
+
+int candidates_tile_of(struct wlchewing_candidates *candidates, int page);
+
+// left of the first cell of the tile
+static inline int candidates_tile_x(struct wlchewing_candidates *candidates,
+		int tile) {
+	return candidates->cell_x[candidates->page_starts[
+		candidates->tile_starts[tile]]];
+}
+
+// index of cell at x from the left of page, -1 if none
+int candidates_at(struct wlchewing_candidates *candidates, int page, int x);
+
+#endif
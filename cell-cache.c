@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cell-cache.h"
+#include "xmem.h"
+
+struct cell_key {
+	const char *text;
+	char hint;
+	bool selected;
+	int32_t scale, subpixel;
+	int width, height;
+};
+
+static uint64_t key_hash(const struct cell_key *key) {
+	const int32_t head[] = {key->hint, key->selected, key->scale,
+		key->subpixel, key->width, key->height};
+	return fnv1a(fnv1a(fnv1a_basis, head, sizeof(head)), key->text,
+		strlen(key->text));
+}
+
+static bool key_match(const struct wlchewing_lru_node *node,
+		const void *data) {
+	const struct wlchewing_cell_entry *entry =
+		wl_container_of(node, entry, node);
+	const struct cell_key *key = data;
+	return entry->hint == key->hint && entry->selected == key->selected &&
+		entry->scale == key->scale &&
+		entry->subpixel == key->subpixel &&
+		entry->width == key->width && entry->height == key->height &&
+		strcmp(entry->text, key->text) == 0;
+}
+
+static void entry_destroy(struct wlchewing_lru_node *node) {
+	struct wlchewing_cell_entry *entry = wl_container_of(node, entry, node);
+	cairo_surface_destroy(entry->image);
+	free(entry);
+}
+
+struct wlchewing_cell_cache *cell_cache_new(size_t max_bytes) {
+	struct wlchewing_cell_cache *cache = xcalloc(1,
+		sizeof(struct wlchewing_cell_cache));
+	lru_init(&cache->lru, max_bytes, entry_destroy);
+	return cache;
+}
+
+void cell_cache_destroy(struct wlchewing_cell_cache *cache) {
+	lru_finish(&cache->lru);
+	free(cache);
+}
+
+struct wlchewing_cell_entry *cell_cache_find(struct wlchewing_cell_cache *cache,
+		const char *text, char hint, bool selected, int32_t scale,
+		int32_t subpixel, int width, int height) {
+	const struct cell_key key = {text, hint, selected, scale, subpixel,
+		width, height};
+	struct wlchewing_lru_node *node = lru_find(&cache->lru,
+		key_hash(&key), key_match, &key);
+	struct wlchewing_cell_entry *entry = node ?
+		wl_container_of(node, entry, node) : NULL;
+	return entry;
+}
+
+struct wlchewing_cell_entry *cell_cache_insert(
+		struct wlchewing_cell_cache *cache, const char *text, char hint,
+		bool selected, int32_t scale, int32_t subpixel, int width, int height,
+		cairo_surface_t *image) {
+	const struct cell_key key = {text, hint, selected, scale, subpixel,
+		width, height};
+	size_t len = strlen(text);
+	struct wlchewing_cell_entry *entry = xcalloc(1,
+		sizeof(struct wlchewing_cell_entry) + len + 1);
+	memcpy(entry->text, text, len);
+	entry->node.hash = key_hash(&key);
+	entry->hint = hint;
+	entry->selected = selected;
+	entry->scale = scale;
+	entry->subpixel = subpixel;
+	entry->width = width;
+	entry->height = height;
+	entry->image = image;
+	entry->node.bytes = sizeof(struct wlchewing_cell_entry) + len + 1 +
+		(size_t)cairo_image_surface_get_stride(image) *
+		cairo_image_surface_get_height(image);
+	lru_insert(&cache->lru, &entry->node);
+	return entry;
+}
@@ -0,0 +1,41 @@
+#ifndef CELL_CACHE_H
+#define CELL_CACHE_H
+
+#include <cairo.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lru.h"
+
+struct wlchewing_cell_entry {
+	struct wlchewing_lru_node node;
+	char hint; // 0 without key hint
+	bool selected;
+	int32_t scale, subpixel;
+	int width, height;
+	cairo_surface_t *image; // in device pixels
+	char text[];
+};
+
+// rasterized candidate cells, background included, render worker only
+struct wlchewing_cell_cache {
+	struct wlchewing_lru lru; // struct wlchewing_cell_entry
+};
+
+// colors, font and offload are settled before, cells are never repainted
+struct wlchewing_cell_cache *cell_cache_new(size_t max_bytes);
+
+void cell_cache_destroy(struct wlchewing_cell_cache *cache);
+
+// NULL if not there, otherwise valid until the next insert
+struct wlchewing_cell_entry *cell_cache_find(struct wlchewing_cell_cache *cache,
+	const char *text, char hint, bool selected, int32_t scale,
+	int32_t subpixel, int width, int height);
+
+// takes the image, valid until the next insert
+struct wlchewing_cell_entry *cell_cache_insert(
+	struct wlchewing_cell_cache *cache, const char *text, char hint,
+	bool selected, int32_t scale, int32_t subpixel, int width, int height,
+	cairo_surface_t *image);
+
+#endif
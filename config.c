@@ -18,6 +18,18 @@ static const struct option long_options[] = {
 	{"force-default-keymap",no_argument,		NULL,	1},
 	{"no-num-key-hint",	no_argument,		NULL,	2},
 	{"seat",		required_argument,	NULL,	3},
+	{"roundtrip-per-key",	no_argument,		NULL,	4},
+	{"stats",		no_argument,		NULL,	5},
+	{"bypass-terminal",	no_argument,		NULL,	6},
+	{"vte-hack",		required_argument,	NULL,	7},
+	{"reader-thread",	no_argument,		NULL,	8},
+	{"roundtrip-budget",	required_argument,	NULL,	9},
+	{"layout-cache",	required_argument,	NULL,	10},
+	{"cell-cache",		required_argument,	NULL,	11},
+	{"renderer",		required_argument,	NULL,	12},
+	{"benchmark",		required_argument,	NULL,	13},
+	{"offload",		no_argument,		NULL,	14},
+	{"strip",		no_argument,		NULL,	15},
 	{0},
 };
 
@@ -44,6 +56,36 @@ Usage: %s [OPTIONS]...\n\
   -n, --no-tray-icon            Disable tray icon\n\
       --no-num-key-hint         Disable number key display on candidate panel\n\
       --seat=SEAT               Select seat, defaults to last announced seat\n\
+      --roundtrip-per-key       Wait for compositor after handling each key\n\
+      --stats                   Print latency statistics on exit\n\
+      --bypass-terminal         Do not convert in fields declared as terminal\n\
+      --vte-hack=(auto|always|never)\n\
+                                Recreate input method after preedit is cleared\n\
+                                to work around VTE, defaults to auto\n\
+                                  auto   Only in fields declared as terminal\n\
+      --reader-thread           Read keyboard events on a separate thread\n\
+      --roundtrip-budget=MS     Give up waiting for compositor after MS\n\
+                                milliseconds, defaults to 200\n\
+      --layout-cache=KIB        Keep about KIB kilobytes of shaped candidates\n\
+                                across panel openings, defaults to 1024\n\
+      --cell-cache=KIB          Keep about KIB kilobytes of painted candidates\n\
+                                across panel openings, defaults to 4096\n\
+      --renderer=(cell|row|glyph)\n\
+                                Set how candidate panel is drawn, defaults to\n\
+                                cell\n\
+                                  cell  Shape and paint each candidate alone,\n\
+                                        copied from cache when painted before\n\
+                                  row   Shape candidates on the panel at once\n\
+                                  glyph Rasterize each glyph once with\n\
+                                        FreeType and blend it into the panel\n\
+      --benchmark=FRAMES        Draw FRAMES candidate panel frames with each\n\
+                                renderer, print the time taken and exit\n\
+      --offload                 Let compositor draw panel background and\n\
+                                selection highlight, moving the selection\n\
+                                within a page redraws nothing\n\
+      --strip                   Draw every page of candidates once and scroll\n\
+                                over them, needs --offload and the same text\n\
+                                and selection text colors\n\
 \n\
 COLOR is color specified as either #RRGGBB or #RRGGBBAA.\n";
 
@@ -55,6 +97,9 @@ void config_init(struct wlchewing_config *config) {
 		.selection_color	= {0.25, 0.25, 0.25, 1.0},
 		.tray_icon		= true,
 		.key_hint		= true,
+		.roundtrip_budget_ms	= 200,
+		.layout_cache_kib	= 1024,
+		.cell_cache_kib		= 4096,
 	};
 }
 
@@ -126,6 +171,88 @@ int config_read_opts(int argc, char *argv[], struct wlchewing_config *config) {
 		case 3:
 			config->seat = optarg;
 			break;
+		case 4:
+			config->roundtrip_per_key = true;
+			break;
+		case 5:
+			config->stats = true;
+			break;
+		case 6:
+			config->bypass_terminal = true;
+			break;
+		case 7:
+			if (!strcmp(optarg, "auto")) {
+				config->vte_hack = VTE_HACK_AUTO;
+			} else if (!strcmp(optarg, "always")) {
+				config->vte_hack = VTE_HACK_ALWAYS;
+			} else if (!strcmp(optarg, "never")) {
+				config->vte_hack = VTE_HACK_NEVER;
+			} else {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		case 8:
+			config->reader_thread = true;
+			break;
+		case 9: {
+			char dummy;
+			if (sscanf(optarg, "%d%c", &config->roundtrip_budget_ms,
+					&dummy) != 1 ||
+					config->roundtrip_budget_ms <= 0) {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		}
+		case 10: {
+			char dummy;
+			if (sscanf(optarg, "%d%c", &config->layout_cache_kib,
+					&dummy) != 1 ||
+					config->layout_cache_kib < 0) {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		}
+		case 11: {
+			char dummy;
+			if (sscanf(optarg, "%d%c", &config->cell_cache_kib,
+					&dummy) != 1 ||
+					config->cell_cache_kib < 0) {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		}
+		case 12:
+			if (!strcmp(optarg, "cell")) {
+				config->renderer = RENDERER_CELL;
+			} else if (!strcmp(optarg, "row")) {
+				config->renderer = RENDERER_ROW;
+			} else if (!strcmp(optarg, "glyph")) {
+				config->renderer = RENDERER_GLYPH;
+			} else {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		case 13: {
+			char dummy;
+			if (sscanf(optarg, "%d%c", &config->benchmark_frames,
+					&dummy) != 1 ||
+					config->benchmark_frames <= 0) {
+				fprintf(stderr, help, argv[0]);
+				return -EINVAL;
+			}
+			break;
+		}
+		case 14:
+			config->offload = true;
+			break;
+		case 15:
+			config->strip = true;
+			break;
 		}
 	}
 	return 0;
@@ -7,8 +7,22 @@ enum dock_option {
 	DOCK_DOCK,
 };
 
+enum renderer_option {
+	RENDERER_CELL = 0,
+	RENDERER_ROW,
+	RENDERER_GLYPH,
+};
+
+enum vte_hack_option {
+	VTE_HACK_AUTO = 0,
+	VTE_HACK_ALWAYS,
+	VTE_HACK_NEVER,
+};
+
 struct wlchewing_config {
 	enum dock_option dock;
+	enum vte_hack_option vte_hack;
+	enum renderer_option renderer;
 	const char *font;
 	const char *seat;
 	double text_color[4];
@@ -20,6 +34,16 @@ struct wlchewing_config {
 	bool tray_icon;
 	bool key_hint;
 	bool chewing_use_xkb_default;
+	bool roundtrip_per_key;
+	bool stats;
+	bool bypass_terminal;
+	bool reader_thread;
+	bool offload;
+	bool strip;
+	int roundtrip_budget_ms;
+	int layout_cache_kib;
+	int cell_cache_kib;
+	int benchmark_frames;
 };
 
 void config_init(struct wlchewing_config *config);
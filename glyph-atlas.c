@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client-protocol.h>
+
+#include "buffer.h"
+#include "errors.h"
+#include "glyph-atlas.h"
+#include "xmem.h"
+
+static constexpr int atlas_size = 512;
+static constexpr int bucket_count = 1024;
+// dropped with the glyphs past it, slots only point to their fonts
+static constexpr int max_faces = 32;
+
+enum glyph_mode {
+	GLYPH_GRAY,
+	GLYPH_RGB,
+	GLYPH_BGR,
+};
+
+struct wlchewing_glyph_atlas *glyph_atlas_new(void) {
+	struct wlchewing_glyph_atlas *atlas = xcalloc(1,
+		sizeof(struct wlchewing_glyph_atlas));
+	if (FT_Init_FreeType(&atlas->library)) {
+		wlchewing_err("Failed to initialize FreeType");
+		exit(EXIT_FAILURE);
+	}
+	// not available in every build, grayscale fringes then
+	FT_Library_SetLcdFilter(atlas->library, FT_LCD_FILTER_DEFAULT);
+	wl_list_init(&atlas->faces);
+	atlas->texels = xcalloc(atlas_size * atlas_size, sizeof(uint32_t));
+	memset(atlas->buckets, -1, sizeof(atlas->buckets));
+	return atlas;
+}
+
+static void glyph_atlas_drop_faces(struct wlchewing_glyph_atlas *atlas) {
+	struct wlchewing_glyph_face *face, *tmp;
+	wl_list_for_each_safe(face, tmp, &atlas->faces, link) {
+		wl_list_remove(&face->link);
+		if (face->face) {
+			FT_Done_Face(face->face);
+		}
+		hb_blob_destroy(face->blob);
+		g_object_unref(face->font);
+		free(face);
+	}
+	atlas->face_count = 0;
+}
+
+void glyph_atlas_destroy(struct wlchewing_glyph_atlas *atlas) {
+	glyph_atlas_drop_faces(atlas);
+	FT_Done_FreeType(atlas->library);
+	free(atlas->texels);
+	free(atlas->slots);
+	free(atlas);
+}
+
+static void glyph_atlas_reset(struct wlchewing_glyph_atlas *atlas) {
+	atlas->slot_count = 0;
+	memset(atlas->buckets, -1, sizeof(atlas->buckets));
+	atlas->shelf_x = atlas->shelf_y = atlas->shelf_height = 0;
+	atomic_fetch_add_explicit(&atlas->resets, 1, memory_order_relaxed);
+}
+
+static struct wlchewing_glyph_face *glyph_atlas_face(
+		struct wlchewing_glyph_atlas *atlas, PangoFont *font) {
+	struct wlchewing_glyph_face *face;
+	wl_list_for_each(face, &atlas->faces, link) {
+		if (face->font == font) {
+			return face;
+		}
+	}
+	if (atlas->face_count == max_faces) {
+		glyph_atlas_reset(atlas);
+		glyph_atlas_drop_faces(atlas);
+	}
+	// kept even if freetype cannot load it, not to try again
+	face = xcalloc(1, sizeof(struct wlchewing_glyph_face));
+	face->font = g_object_ref(font);
+	hb_face_t *hb_face = hb_font_get_face(pango_font_get_hb_font(font));
+	face->blob = hb_face_reference_blob(hb_face);
+	unsigned length;
+	const char *data = hb_blob_get_data(face->blob, &length);
+	if (!length || FT_New_Memory_Face(atlas->library,
+			(const FT_Byte *)data, length,
+			hb_face_get_index(hb_face), &face->face)) {
+		face->face = NULL;
+	}
+	PangoFontDescription *desc =
+		pango_font_describe_with_absolute_size(font);
+	face->size = pango_font_description_get_size(desc);
+	pango_font_description_free(desc);
+	wl_list_insert(&atlas->faces, &face->link);
+	atlas->face_count++;
+	return face;
+}
+
+static size_t slot_bucket(PangoFont *font, uint32_t glyph, int32_t scale,
+		int mode) {
+	uint64_t hash = (uintptr_t)font * 0x9e3779b97f4a7c15 ^
+		((glyph * 31 + scale) * 4 + mode);
+	return (hash ^ hash >> 29) & (bucket_count - 1);
+}
+
+static int glyph_atlas_find(struct wlchewing_glyph_atlas *atlas,
+		PangoFont *font, uint32_t glyph, int32_t scale, int mode) {
+	int index = atlas->buckets[slot_bucket(font, glyph, scale, mode)];
+	for (; index >= 0; index = atlas->slots[index].next) {
+		struct wlchewing_glyph_slot *slot = &atlas->slots[index];
+		if (slot->font == font && slot->glyph == glyph &&
+				slot->scale == scale && slot->mode == mode) {
+			return index;
+		}
+	}
+	return -1;
+}
+
+// slot index, -1 if it cannot be drawn
+static int glyph_atlas_rasterize(struct wlchewing_glyph_atlas *atlas,
+		PangoFont *font, uint32_t glyph, int32_t scale, int mode) {
+	struct wlchewing_glyph_face *face = glyph_atlas_face(atlas, font);
+	if (!face->face) {
+		return -1;
+	}
+	if (face->scale != scale) {
+		FT_Set_Char_Size(face->face, 0,
+			(FT_F26Dot6)face->size * scale * 64 /
+			(PANGO_SCALE * scale_unit), 72, 72);
+		face->scale = scale;
+	}
+	if (FT_Load_Glyph(face->face, glyph, mode == GLYPH_GRAY ?
+			FT_LOAD_TARGET_NORMAL : FT_LOAD_TARGET_LCD) ||
+			FT_Render_Glyph(face->face->glyph, mode == GLYPH_GRAY ?
+			FT_RENDER_MODE_NORMAL : FT_RENDER_MODE_LCD)) {
+		return -1;
+	}
+	const FT_Bitmap *bitmap = &face->face->glyph->bitmap;
+	const bool lcd = bitmap->pixel_mode == FT_PIXEL_MODE_LCD;
+	if (!lcd && bitmap->pixel_mode != FT_PIXEL_MODE_GRAY) {
+		return -1;
+	}
+	const int width = lcd ? bitmap->width / 3 : bitmap->width;
+	const int height = bitmap->rows;
+	if (width > atlas_size || height > atlas_size) {
+		return -1;
+	}
+
+	// shelves, everything goes when full
+	if (atlas->shelf_x + width > atlas_size) {
+		atlas->shelf_y += atlas->shelf_height;
+		atlas->shelf_x = atlas->shelf_height = 0;
+	}
+	if (atlas->shelf_y + height > atlas_size) {
+		glyph_atlas_reset(atlas);
+	}
+	if (atlas->slot_count == atlas->slot_capacity) {
+		atlas->slot_capacity = atlas->slot_capacity ?
+			atlas->slot_capacity * 2 : 256;
+		atlas->slots = xrealloc(atlas->slots, atlas->slot_capacity *
+			sizeof(struct wlchewing_glyph_slot));
+	}
+	const int index = atlas->slot_count++;
+	struct wlchewing_glyph_slot *slot = &atlas->slots[index];
+	size_t bucket = slot_bucket(font, glyph, scale, mode);
+	*slot = (struct wlchewing_glyph_slot) {
+		.font = font,
+		.glyph = glyph,
+		.scale = scale,
+		.mode = mode,
+		.x = atlas->shelf_x,
+		.y = atlas->shelf_y,
+		.width = width,
+		.height = height,
+		.left = face->face->glyph->bitmap_left,
+		.top = face->face->glyph->bitmap_top,
+		.next = atlas->buckets[bucket],
+	};
+	atlas->buckets[bucket] = index;
+	atlas->shelf_x += width;
+	if (height > atlas->shelf_height) {
+		atlas->shelf_height = height;
+	}
+
+	for (int row = 0; row < height; row++) {
+		const uint8_t *src = bitmap->buffer + row * bitmap->pitch;
+		uint32_t *dst = atlas->texels + (slot->y + row) * atlas_size +
+			slot->x;
+		for (int col = 0; col < width; col++) {
+			uint32_t r, g, b;
+			if (lcd) {
+				r = src[col * 3];
+				g = src[col * 3 + 1];
+				b = src[col * 3 + 2];
+				if (mode == GLYPH_BGR) {
+					uint32_t t = r;
+					r = b;
+					b = t;
+				}
+			} else {
+				r = g = b = src[col];
+			}
+			dst[col] = r << 16 | g << 8 | b;
+		}
+	}
+	return index;
+}
+
+static inline uint32_t div255(uint32_t x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+// premultiplied destination, straight color, coverage per channel
+static void blend_span(uint32_t *restrict dst,
+		const uint32_t *restrict coverage, int n, const uint32_t color[4]) {
+	const uint32_t cr = color[0], cg = color[1], cb = color[2];
+	const uint32_t ca = color[3];
+	for (int i = 0; i < n; i++) {
+		const uint32_t c = coverage[i], d = dst[i];
+		const uint32_t ar = div255((c >> 16 & 0xff) * ca);
+		const uint32_t ag = div255((c >> 8 & 0xff) * ca);
+		const uint32_t ab = div255((c & 0xff) * ca);
+		uint32_t aa = ar > ag ? ar : ag;
+		aa = aa > ab ? aa : ab;
+		const uint32_t a = div255(255 * aa + (d >> 24) * (255 - aa));
+		const uint32_t r = div255(cr * ar +
+			(d >> 16 & 0xff) * (255 - ar));
+		const uint32_t g = div255(cg * ag +
+			(d >> 8 & 0xff) * (255 - ag));
+		const uint32_t b = div255(cb * ab + (d & 0xff) * (255 - ab));
+		dst[i] = a << 24 | r << 16 | g << 8 | b;
+	}
+}
+
+void glyph_atlas_draw(struct wlchewing_glyph_atlas *atlas,
+		cairo_surface_t *target, PangoLayout *layout, int32_t scale,
+		int32_t subpixel, const double color[4], int x, int y,
+		const int clip[4]) {
+	PangoLayoutLine *line = pango_layout_get_line_readonly(layout, 0);
+	if (!line) {
+		return;
+	}
+	const int mode = subpixel == WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB ?
+		GLYPH_RGB : subpixel == WL_OUTPUT_SUBPIXEL_HORIZONTAL_BGR ?
+		GLYPH_BGR : GLYPH_GRAY;
+	uint8_t *data = cairo_image_surface_get_data(target);
+	const int stride = cairo_image_surface_get_stride(target);
+	const int x0 = clip[0] > 0 ? clip[0] : 0;
+	const int y0 = clip[1] > 0 ? clip[1] : 0;
+	const int target_width = cairo_image_surface_get_width(target);
+	const int target_height = cairo_image_surface_get_height(target);
+	const int x1 = clip[2] < target_width ? clip[2] : target_width;
+	const int y1 = clip[3] < target_height ? clip[3] : target_height;
+	const uint32_t rgba[4] = {
+		color[0] * 255 + 0.5, color[1] * 255 + 0.5,
+		color[2] * 255 + 0.5, color[3] * 255 + 0.5,
+	};
+
+	const int baseline = pango_layout_get_baseline(layout);
+	int pen = 0;
+	for (GSList *l = line->runs; l; l = l->next) {
+		PangoLayoutRun *run = l->data;
+		PangoFont *font = run->item->analysis.font;
+		for (int i = 0; i < run->glyphs->num_glyphs; i++) {
+			const PangoGlyphInfo *info = &run->glyphs->glyphs[i];
+			const int origin_x = pen + info->geometry.x_offset;
+			const int origin_y = baseline - run->y_offset +
+				info->geometry.y_offset;
+			pen += info->geometry.width;
+			if (info->glyph == PANGO_GLYPH_EMPTY ||
+					(info->glyph & PANGO_GLYPH_UNKNOWN_FLAG)) {
+				continue;
+			}
+			int index = glyph_atlas_find(atlas, font, info->glyph,
+				scale, mode);
+			if (index >= 0) {
+				atomic_fetch_add_explicit(&atlas->hits, 1,
+					memory_order_relaxed);
+			} else {
+				atomic_fetch_add_explicit(&atlas->misses, 1,
+					memory_order_relaxed);
+				index = glyph_atlas_rasterize(atlas, font,
+					info->glyph, scale, mode);
+				if (index < 0) {
+					continue;
+				}
+			}
+			const struct wlchewing_glyph_slot *slot =
+				&atlas->slots[index];
+			const int gx = x + PANGO_PIXELS(
+				(int64_t)origin_x * scale / scale_unit) +
+				slot->left;
+			const int gy = y + PANGO_PIXELS(
+				(int64_t)origin_y * scale / scale_unit) -
+				slot->top;
+			const int from = gx > x0 ? gx : x0;
+			const int to = gx + slot->width < x1 ?
+				gx + slot->width : x1;
+			const int bottom = gy + slot->height < y1 ?
+				gy + slot->height : y1;
+			for (int row = gy > y0 ? gy : y0;
+					from < to && row < bottom; row++) {
+				blend_span((uint32_t *)(data + row * stride) + from,
+					atlas->texels + (slot->y + row - gy) *
+					atlas_size + slot->x + from - gx,
+					to - from, rgba);
+			}
+		}
+	}
+}
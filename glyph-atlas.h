@@ -0,0 +1,63 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include <cairo.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_LCD_FILTER_H
+#include <hb.h>
+#include <pango/pango.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+// freetype face of a pango font, sized for the last scale rasterized at
+struct wlchewing_glyph_face {
+	PangoFont *font; // referenced
+	hb_blob_t *blob; // face data
+	FT_Face face;
+	int size; // pango units
+	int32_t scale;
+	struct wl_list link;
+};
+
+struct wlchewing_glyph_slot {
+	PangoFont *font;
+	uint32_t glyph;
+	int32_t scale;
+	int mode; // enum glyph_mode
+	int x, y, width, height; // in atlas
+	int left, top; // bearing
+	int next; // in bucket, -1 at the end
+};
+
+// glyphs rasterized once by freetype, render worker only
+struct wlchewing_glyph_atlas {
+	FT_Library library;
+	struct wl_list faces; // struct wlchewing_glyph_face
+	int face_count;
+
+	// coverage of red, green and blue as 0x00rrggbb, equal for grayscale
+	uint32_t *texels;
+	int shelf_x, shelf_y, shelf_height;
+
+	struct wlchewing_glyph_slot *slots;
+	int slot_count, slot_capacity;
+	int buckets[1024]; // indices of slots, -1 if empty
+
+	// read by the main thread for stats
+	_Atomic uint64_t hits, misses, resets;
+};
+
+struct wlchewing_glyph_atlas *glyph_atlas_new(void);
+
+void glyph_atlas_destroy(struct wlchewing_glyph_atlas *atlas);
+
+// composites the first line of a shaped layout into an image surface, top
+// left at device pixel x and y, inside the clip given in device pixels
+void glyph_atlas_draw(struct wlchewing_glyph_atlas *atlas,
+	cairo_surface_t *target, PangoLayout *layout, int32_t scale,
+	int32_t subpixel, const double color[4], int x, int y,
+	const int clip[4]);
+
+#endif
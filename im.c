@@ -1,4 +1,3 @@
-#include <sys/mman.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 
@@ -15,52 +14,190 @@ static inline int32_t get_millis() {
 
 static void vte_hack(struct wlchewing_state *state);
 
-static int count_utf8_bytes(const char *s, int codepoints) {
-	int byte_cursor = 0;
-	for (int i = 0; i < codepoints; i++) {
-		uint8_t byte = s[byte_cursor];
-		if (!(byte & 0x80)) {
-			byte_cursor += 1;
-		} else {
-			while (byte & 0x80) {
-				byte <<= 1;
-				byte_cursor++;
-			}
+// with --roundtrip-per-key, wait for the compositor after every event as we
+// used to; otherwise requests stay queued until im_flush
+static void im_maybe_roundtrip(struct wlchewing_state *state) {
+	if (!state->config.roundtrip_per_key) {
+		return;
+	}
+	if (state->key_start_us) {
+		stats_track_ack(state, state->key_start_us);
+		state->key_start_us = 0;
+	}
+	if (!watchdog_roundtrip(state, "handling key")) {
+		// keep the keyboard usable rather than stalling on every key
+		wlchewing_err("Stop waiting for compositor after each key");
+		state->config.roundtrip_per_key = false;
+	}
+}
+
+static void preedit_reserve(struct wlchewing_preedit *preedit, size_t size) {
+	if (size > preedit->size) {
+		preedit->size = size * 2;
+		preedit->text = xrealloc(preedit->text, preedit->size);
+	}
+}
+
+// bopomofo is inserted at cursor, counted in codepoints, while copying
+static void preedit_build(struct wlchewing_preedit *preedit,
+		const char *precommit, int cursor, const char *bopomofo) {
+	size_t precommit_length = strlen(precommit);
+	size_t bopomofo_length = strlen(bopomofo);
+	preedit_reserve(preedit, precommit_length + bopomofo_length + 1);
+
+	char *out = preedit->text;
+	const char *in = precommit;
+	for (int codepoints = 0; *in; in++) {
+		// leading byte
+		if ((*in & 0xc0) != 0x80 && codepoints++ == cursor) {
+			break;
 		}
+		*out++ = *in;
 	}
-	return byte_cursor;
+	preedit->cursor_begin = out - preedit->text;
+	memcpy(out, bopomofo, bopomofo_length);
+	out += bopomofo_length;
+	preedit->cursor_end = out - preedit->text;
+	size_t rest = precommit_length - (in - precommit);
+	memcpy(out, in, rest + 1);
+	preedit->length = precommit_length + bopomofo_length;
 }
 
-static void im_update(struct wlchewing_state *state) {
-	const char *precommit = chewing_buffer_String_static(state->chewing);
-	const char *bopomofo = chewing_bopomofo_String_static(state->chewing);
-
-	int cursor = count_utf8_bytes(precommit,
-		chewing_cursor_Current(state->chewing));
-	int bopomofo_length = strlen(bopomofo);
-	int preedit_length = strlen(precommit) + bopomofo_length;
-	char *preedit = xcalloc(preedit_length + 1, sizeof(char));
-	strncat(preedit, precommit, cursor);
-	strcat(preedit, bopomofo);
-	strcat(preedit, &precommit[cursor]);
-	zwp_input_method_v2_set_preedit_string(state->input_method, preedit,
-		cursor, cursor + bopomofo_length);
-	free(preedit);
+static bool preedit_equal(const struct wlchewing_preedit *a,
+		const struct wlchewing_preedit *b) {
+	return a->length == b->length &&
+		a->cursor_begin == b->cursor_begin &&
+		a->cursor_end == b->cursor_end &&
+		(!a->length || memcmp(a->text, b->text, a->length) == 0);
+}
+
+// the text input starts with no preedit on (re)activation
+static void im_forget_sent_preedit(struct wlchewing_state *state) {
+	state->sent_preedit.length = 0;
+	state->sent_preedit.cursor_begin = 0;
+	state->sent_preedit.cursor_end = 0;
+}
+
+// VTE does not pick up the cleared preedit until input method is recreated
+static bool im_wants_vte_hack(struct wlchewing_state *state) {
+	switch (state->config.vte_hack) {
+	case VTE_HACK_ALWAYS:
+		return true;
+	case VTE_HACK_NEVER:
+		return false;
+	case VTE_HACK_AUTO:
+		return state->content_purpose ==
+			ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_TERMINAL;
+	}
+	return false;
+}
+
+static void im_send_update(struct wlchewing_state *state) {
+	if (state->awaiting_done) {
+		// kept pending, no serial to commit with yet
+		return;
+	}
+	state->pending_update = false;
+	struct wlchewing_preedit *preedit = &state->preedit;
+	preedit_build(preedit, chewing_buffer_String_static(state->chewing),
+		chewing_cursor_Current(state->chewing),
+		chewing_bopomofo_String_static(state->chewing));
+	if (!state->pending_commit_length &&
+			preedit_equal(preedit, &state->sent_preedit)) {
+		return;
+	}
+
+	zwp_input_method_v2_set_preedit_string(state->input_method,
+		preedit->text, preedit->cursor_begin, preedit->cursor_end);
+
+	if (state->pending_commit_length) {
+		zwp_input_method_v2_commit_string(state->input_method,
+			state->pending_commit);
+		state->pending_commit_length = 0;
+	}
+
+	zwp_input_method_v2_commit(state->input_method, state->serial);
+	im_maybe_roundtrip(state);
+
+	// keep the buffer just built as the sent one, reuse the other
+	struct wlchewing_preedit old = state->sent_preedit;
+	state->sent_preedit = state->preedit;
+	state->preedit = old;
+	if (!state->sent_preedit.length && im_wants_vte_hack(state)) {
+		vte_hack(state);
+	}
+}
+
+static void im_append_commit(struct wlchewing_state *state, const char *str) {
+	size_t length = strlen(str);
+	size_t needed = state->pending_commit_length + length + 1;
+	if (needed > state->pending_commit_size) {
+		state->pending_commit_size = needed * 2;
+		state->pending_commit = xrealloc(state->pending_commit,
+			state->pending_commit_size);
+	}
+	memcpy(&state->pending_commit[state->pending_commit_length], str,
+		length + 1);
+	state->pending_commit_length += length;
+}
 
+// libchewing only keeps the latest commit, collect them so that a burst of
+// keys can be sent as a single update
+static void im_collect_commit(struct wlchewing_state *state) {
 	if (chewing_commit_Check(state->chewing)) {
-		zwp_input_method_v2_commit_string(state->input_method, 
+		im_append_commit(state,
 			chewing_commit_String_static(state->chewing));
 		chewing_ack(state->chewing);
 	}
+}
 
-	zwp_input_method_v2_commit(state->input_method, state->serial);
-	wl_display_roundtrip(state->display);
+static void im_update(struct wlchewing_state *state) {
+	im_collect_commit(state);
+	// candidates may be asked for soon, have the panel configured by then
+	if (!state->persistent_bottom_panel &&
+			chewing_bopomofo_Check(state->chewing)) {
+		bottom_panel_prepare(state);
+	}
+	state->pending_update = true;
+	if (state->config.roundtrip_per_key) {
+		im_send_update(state);
+	}
+}
 
-	if (!preedit_length) {
-		vte_hack(state);
+static void im_render(struct wlchewing_state *state) {
+	state->pending_render = true;
+	if (state->config.roundtrip_per_key) {
+		state->pending_render = false;
+		bottom_panel_render(state);
 	}
 }
 
+// send what is left from the events handled so far
+// returns false if the socket is full and flushing should be retried once
+// it becomes writable
+bool im_flush(struct wlchewing_state *state) {
+	if (state->pending_update) {
+		im_send_update(state);
+	}
+	if (state->pending_render) {
+		state->pending_render = false;
+		if (state->bottom_panel) {
+			bottom_panel_render(state);
+		}
+	}
+	if (state->key_start_us) {
+		stats_track_ack(state, state->key_start_us);
+		state->key_start_us = 0;
+	}
+	if (wl_display_flush(state->display) < 0) {
+		if (errno == EAGAIN) {
+			return false;
+		}
+		wlchewing_perr("Failed to flush Wayland requests");
+	}
+	return true;
+}
+
 void im_commit_candidate(struct wlchewing_state *state, int offset) {
 	if (!state->bottom_panel) {
 		return;
@@ -71,7 +208,7 @@ void im_commit_candidate(struct wlchewing_state *state, int offset) {
 	}
 	chewing_cand_choose_by_index(state->chewing, index);
 	chewing_cand_close(state->chewing);
-	bottom_panel_destroy(state->bottom_panel);
+	bottom_panel_close(state->bottom_panel);
 	state->bottom_panel = NULL;
 	im_update(state);
 	return;
@@ -92,212 +229,310 @@ void im_candidates_move_by(struct wlchewing_state *state, int diff) {
 	}
 	if (state->bottom_panel->selected_index != to) {
 		state->bottom_panel->selected_index = to;
-		bottom_panel_render(state);
+		im_render(state);
+	}
+}
+
+void im_candidates_page_by(struct wlchewing_state *state, int diff) {
+	if (!state->bottom_panel) {
+		return;
+	}
+	int from = state->bottom_panel->selected_index;
+	if (!bottom_panel_move_page(state->bottom_panel, diff)) {
+		// pages not known until the first frame
+		im_candidates_move_by(state, 10 * diff);
+	} else if (state->bottom_panel->selected_index != from) {
+		im_render(state);
 	}
 }
 
 void im_reset(struct wlchewing_state *state) {
 	if (state->bottom_panel) {
-		bottom_panel_destroy(state->bottom_panel);
+		bottom_panel_close(state->bottom_panel);
 		state->bottom_panel = NULL;
 	}
 	chewing_Reset(state->chewing);
 }
 
+// commit what is being composed and stop composing
+static void im_leave_chewing(struct wlchewing_state *state) {
+	if (chewing_buffer_Check(state->chewing)) {
+		chewing_commit_preedit_buf(state->chewing);
+	}
+	im_reset(state);
+	// sends the commit and the now empty preedit
+	im_update(state);
+}
+
 void im_mode_switch(struct wlchewing_state *state, bool forwarding) {
 	if (state->forwarding == forwarding) {
 		return;
 	}
-	if (forwarding) {
-		// toggling to English, do commit and reset
-		if (chewing_buffer_Check(state->chewing)) {
-			chewing_commit_preedit_buf(state->chewing);
-			zwp_input_method_v2_commit_string(state->input_method,
-				chewing_commit_String_static(state->chewing));
-			chewing_ack(state->chewing);
-		}
-		im_reset(state);
-		zwp_input_method_v2_set_preedit_string(state->input_method, "",
-			0, 0);
-		zwp_input_method_v2_commit(state->input_method, state->serial);
-		wl_display_roundtrip(state->display);
-		vte_hack(state);
+	if (forwarding && !state->bypass) {
+		// toggling to English
+		im_leave_chewing(state);
 	}
 	state->forwarding = forwarding;
 	sni_notify_new_icon(state->sni);
 }
 
-enum press_action im_key_press(struct wlchewing_state *state, uint32_t key) {
-	xkb_keysym_t keysym = xkb_state_key_get_one_sym(state->xkb_state,
-		key + 8);
+static bool im_content_type_bypass(struct wlchewing_state *state,
+		uint32_t hint, uint32_t purpose) {
+	if (hint & (ZWP_TEXT_INPUT_V3_CONTENT_HINT_HIDDEN_TEXT |
+			ZWP_TEXT_INPUT_V3_CONTENT_HINT_SENSITIVE_DATA)) {
+		return true;
+	}
+	switch (purpose) {
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_DIGITS:
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NUMBER:
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PHONE:
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PASSWORD:
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_PIN:
+		return true;
+	case ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_TERMINAL:
+		return state->config.bypass_terminal;
+	default:
+		return false;
+	}
+}
 
-	if (xkb_state_mod_name_is_active(state->xkb_state, XKB_MOD_NAME_CTRL,
-			XKB_STATE_MODS_EFFECTIVE) > 0) {
-		if (keysym == XKB_KEY_space) {
-			im_mode_switch(state, !state->forwarding);
-			return PRESS_ARM_TIMER;
+static enum press_action im_handle_action(struct wlchewing_state *state,
+		struct wlchewing_key key, int count);
+
+static enum press_action im_handle_panel_action(struct wlchewing_state *state,
+		struct wlchewing_key key, int count) {
+	// keys closing the panel leave the rest of repeats to libchewing
+	int consumed = count;
+	if (key.candidate >= 0) {
+		// hints are numbered from the start of the page
+		struct wlchewing_bottom_panel *panel = state->bottom_panel;
+		im_commit_candidate(state, bottom_panel_page_start(panel) +
+			key.candidate - panel->selected_index);
+		consumed = 1;
+	} else switch (key.action) {
+	case KEY_ACTION_ENTER:
+		im_commit_candidate(state, 0);
+		consumed = 1;
+		break;
+	case KEY_ACTION_LEFT:
+		im_candidates_move_by(state, -count);
+		break;
+	case KEY_ACTION_RIGHT:
+		im_candidates_move_by(state, count);
+		break;
+	case KEY_ACTION_PAGE_UP:
+		im_candidates_page_by(state, -count);
+		break;
+	case KEY_ACTION_PAGE_DOWN:
+		im_candidates_page_by(state, count);
+		break;
+	case KEY_ACTION_UP:
+		chewing_cand_close(state->chewing);
+		bottom_panel_close(state->bottom_panel);
+		state->bottom_panel = NULL;
+		consumed = 1;
+		break;
+	case KEY_ACTION_DOWN:
+		for (int i = 0; i < count; i++) {
+			if (chewing_cand_list_has_next(state->chewing)) {
+				chewing_cand_list_next(state->chewing);
+			} else {
+				chewing_cand_list_first(state->chewing);
+			}
 		}
-		return PRESS_FORWARD;
+		state->bottom_panel->selected_index = 0;
+		bottom_panel_candidates_changed(state->bottom_panel);
+		im_render(state);
+		break;
+	default:
+		// no-op
+		break;
 	}
-	if (xkb_state_mod_name_is_active(state->xkb_state, XKB_MOD_NAME_ALT,
-			XKB_STATE_MODS_EFFECTIVE) > 0 ||
-			xkb_state_mod_name_is_active(state->xkb_state,
-			XKB_MOD_NAME_LOGO, XKB_STATE_MODS_EFFECTIVE) > 0) {
-		// Alt and Logo are not used by us
-		return PRESS_FORWARD;
+	if (consumed < count) {
+		im_handle_action(state, key, count - consumed);
 	}
+	// We grabs all the keys when panel is there,
+	// as if it has the focus.
+	return PRESS_ARM_TIMER;
+}
 
-	state->shift_only = keysym == XKB_KEY_Shift_L ||
-		keysym == XKB_KEY_Shift_R;
-
-	if (state->forwarding) {
-		return PRESS_FORWARD;
+static enum press_action im_handle_action(struct wlchewing_state *state,
+		struct wlchewing_key key, int count) {
+	if (state->bottom_panel) {
+		return im_handle_panel_action(state, key, count);
 	}
 
-	if (state->bottom_panel) {
-		switch (keysym) {
-		case XKB_KEY_Return:
-		case XKB_KEY_KP_Enter:
-			im_commit_candidate(state, 0);
-			break;
-		case XKB_KEY_1 ... XKB_KEY_9:
-			im_commit_candidate(state, keysym - XKB_KEY_1);
+	bool handled = true;
+	int i = 0;
+	for (; i < count && handled; i++) {
+		switch (key.action) {
+		case KEY_ACTION_BACKSPACE:
+			chewing_handle_Backspace(state->chewing);
 			break;
-		case XKB_KEY_KP_1 ... XKB_KEY_KP_9:
-			im_commit_candidate(state, keysym - XKB_KEY_KP_1);
+		case KEY_ACTION_DELETE:
+			chewing_handle_Del(state->chewing);
 			break;
-		case XKB_KEY_0:
-		case XKB_KEY_KP_0:
-			im_commit_candidate(state, 9);
+		case KEY_ACTION_ENTER:
+			chewing_handle_Enter(state->chewing);
 			break;
-		case XKB_KEY_Left:
-		case XKB_KEY_KP_Left:
-			im_candidates_move_by(state, -1);
+		case KEY_ACTION_LEFT:
+			chewing_handle_Left(state->chewing);
 			break;
-		case XKB_KEY_Right:
-		case XKB_KEY_KP_Right:
-			im_candidates_move_by(state, 1);
+		case KEY_ACTION_RIGHT:
+			chewing_handle_Right(state->chewing);
 			break;
-		case XKB_KEY_Page_Up:
-		case XKB_KEY_KP_Page_Up:
-			im_candidates_move_by(state, -10);
+		case KEY_ACTION_HOME:
+			chewing_handle_Home(state->chewing);
 			break;
-		case XKB_KEY_Page_Down:
-		case XKB_KEY_KP_Page_Down:
-			im_candidates_move_by(state, 10);
+		case KEY_ACTION_END:
+			chewing_handle_End(state->chewing);
 			break;
-		case XKB_KEY_Up:
-		case XKB_KEY_KP_Up:
+		case KEY_ACTION_DOWN:
+			chewing_cand_open(state->chewing);
+			if (chewing_cand_TotalChoice(state->chewing)) {
+				state->bottom_panel = bottom_panel_open(state);
+				im_render(state);
+				if (count > 1) {
+					im_handle_panel_action(state, key,
+						count - 1);
+				}
+				return PRESS_ARM_TIMER;
+			}
 			chewing_cand_close(state->chewing);
-			bottom_panel_destroy(state->bottom_panel);
-			state->bottom_panel = NULL;
+			handled = false;
 			break;
-		case XKB_KEY_Down:
-		case XKB_KEY_KP_Down:
-			if (chewing_cand_list_has_next(state->chewing)) {
-				chewing_cand_list_next(state->chewing);
-			} else {
-				chewing_cand_list_first(state->chewing);
-			}
-			state->bottom_panel->selected_index = 0;
-			bottom_panel_render(state);
+		case KEY_ACTION_UP:
+			// consume if dirty
+			handled = chewing_buffer_Check(state->chewing) ||
+				chewing_bopomofo_Check(state->chewing);
+			break;
+		case KEY_ACTION_PRINTABLE:
+			chewing_handle_Default(state->chewing,
+				(char)xkb_keysym_to_utf32(key.keysym));
 			break;
 		default:
 			// no-op
 			break;
 		}
-		// We grabs all the keys when panel is there,
-		// as if it has the focus.
-		return PRESS_ARM_TIMER;
+		handled = handled &&
+			!chewing_keystroke_CheckIgnore(state->chewing);
+		// the next repeat would overwrite it
+		im_collect_commit(state);
+	}
+	// nothing consumed, forward it (or drop the repeats)
+	if (!handled && i == 1) {
+		return PRESS_FORWARD;
 	}
 
-	bool handled = true;
-	switch (keysym) {
-	case XKB_KEY_BackSpace:
-		chewing_handle_Backspace(state->chewing);
-		break;
-	case XKB_KEY_Delete:
-	case XKB_KEY_KP_Delete:
-		chewing_handle_Del(state->chewing);
-		break;
-	case XKB_KEY_Return:
-	case XKB_KEY_KP_Enter:
-		chewing_handle_Enter(state->chewing);
-		break;
-	case XKB_KEY_Left:
-	case XKB_KEY_KP_Left:
-		chewing_handle_Left(state->chewing);
-		break;
-	case XKB_KEY_Right:
-	case XKB_KEY_KP_Right:
-		chewing_handle_Right(state->chewing);
-		break;
-	case XKB_KEY_Home:
-		chewing_handle_Home(state->chewing);
-		break;
-	case XKB_KEY_End:
-		chewing_handle_End(state->chewing);
-		break;
-	case XKB_KEY_Down:
-	case XKB_KEY_KP_Down:
-		chewing_cand_open(state->chewing);
-		if (chewing_cand_TotalChoice(state->chewing)) {
-			state->bottom_panel = bottom_panel_new(state);
-			bottom_panel_render(state);
-			return PRESS_ARM_TIMER;
+	im_update(state);
+	return PRESS_ARM_TIMER;
+}
+
+static inline bool im_passthrough(struct wlchewing_state *state) {
+	return state->forwarding || state->bypass;
+}
+
+static void im_update_xkb_state(struct wlchewing_state *state) {
+	xkb_state_update_mask(state->xkb_state, state->mods_depressed,
+		state->mods_latched, state->mods_locked, 0, 0, state->group);
+	state->xkb_state_stale = false;
+}
+
+// count is the number of key repeats to apply at once
+enum press_action im_key_press(struct wlchewing_state *state, uint32_t key,
+		int count) {
+	struct wlchewing_keymap *keymap = state->keymap;
+	struct wlchewing_key pressed;
+	if (!keymap_key_get(keymap, state->mods, state->group, key + 8,
+			&pressed)) {
+		// rare enough for xkb_state to be updated only now
+		if (state->xkb_state_stale) {
+			im_update_xkb_state(state);
 		}
-		chewing_cand_close(state->chewing);
-		handled = false;
-		break;
-	case XKB_KEY_Up:
-	case XKB_KEY_KP_Up:
-		// consume if dirty
-		handled = chewing_buffer_Check(state->chewing) ||
-			chewing_bopomofo_Check(state->chewing);
-		break;
-	default:
-		// printable characters
-		if (keysym >= XKB_KEY_space &&
-				keysym <= XKB_KEY_asciitilde) {
-			chewing_handle_Default(state->chewing,
-				(char)xkb_keysym_to_utf32(keysym));
+		pressed = keymap_key_get_xkb(state->xkb_state, key + 8);
+	}
+
+	if (state->mods & keymap->ctrl_mask) {
+		if (pressed.keysym == XKB_KEY_space) {
+			if (count % 2) {
+				im_mode_switch(state, !state->forwarding);
+			}
+			return PRESS_ARM_TIMER;
 		}
+		return PRESS_FORWARD;
 	}
-	if (!handled || chewing_keystroke_CheckIgnore(state->chewing)) {
+	if (state->mods & (keymap->alt_mask | keymap->logo_mask)) {
+		// Alt and Logo are not used by us
 		return PRESS_FORWARD;
 	}
 
-	im_update(state);
-	return PRESS_ARM_TIMER;
+	state->shift_only = pressed.action == KEY_ACTION_SHIFT;
+
+	if (im_passthrough(state)) {
+		return PRESS_FORWARD;
+	}
+
+	return im_handle_action(state, pressed, count);
 }
 
-static void keyboard_grab_key(void *data,
-		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
-		uint32_t serial, uint32_t time,
+void im_key_repeat(struct wlchewing_state *state, uint64_t expirations) {
+	if (!state->last_key) {
+		return;
+	}
+	// catch up on repeats missed while busy, up to a second worth of them
+	uint64_t max = 1;
+	if (state->repeat_info.it_interval.tv_nsec) {
+		max = 1000 * 1000 * 1000 /
+			state->repeat_info.it_interval.tv_nsec;
+	}
+	im_key_press(state, state->last_key,
+		expirations < max ? expirations : max);
+}
+
+// English mode or bypassed field, forward everything but the toggle chords
+// without going through xkb_state
+static enum press_action im_passthrough_press(struct wlchewing_state *state,
+		uint32_t key) {
+	struct wlchewing_keymap *keymap = state->keymap;
+	struct wlchewing_key pressed = keymap_key_get_base(keymap,
+		state->group, key + 8);
+	if (state->mods & keymap->ctrl_mask) {
+		if (pressed.keysym == XKB_KEY_space) {
+			return im_key_press(state, key, 1);
+		}
+		return PRESS_FORWARD;
+	}
+	if (!(state->mods & (keymap->alt_mask | keymap->logo_mask))) {
+		state->shift_only = pressed.action == KEY_ACTION_SHIFT;
+	}
+	return PRESS_FORWARD;
+}
+
+static void im_handle_key(struct wlchewing_state *state, uint32_t time,
 		uint32_t key, uint32_t key_state) {
-	struct wlchewing_state *state = data;
+	bool passthrough = im_passthrough(state);
 	if (key_state == WL_KEYBOARD_KEY_STATE_PRESSED) {
-		struct wlchewing_keysym *newkey;
-		switch (im_key_press(state, key)) {
+		switch (passthrough ? im_passthrough_press(state, key) :
+				im_key_press(state, key, 1)) {
 		case PRESS_FORWARD:
+			// text from earlier keys goes first
+			if (state->pending_update) {
+				im_send_update(state);
+			}
 			zwp_virtual_keyboard_v1_key(state->virtual_keyboard,
 				time, key, key_state);
 			// record press sent keys,
 			// to pop pending release on deactivate
-			newkey = xcalloc(1, sizeof(struct wlchewing_keysym));
-			newkey->key = key;
-			wl_list_insert(&state->press_sent_keysyms,
-				&newkey->link);
+			keyset_add(&state->press_sent_keys, key);
 			// update translation of our clock to keyboard_grab
 			state->millis_offset = get_millis() - time;
-			wl_display_roundtrip(state->display);
+			if (!passthrough) {
+				im_maybe_roundtrip(state);
+			}
 			break;
 		case PRESS_ARM_TIMER:
 			// record that we should not forward key release
-			newkey = xcalloc(1, sizeof(struct wlchewing_keysym));
-			newkey->key = key;
-			wl_list_insert(&state->pending_handled_keysyms,
-				&newkey->link);
+			keyset_add(&state->pending_handled_keys, key);
 			if (state->repeat_info.it_interval.tv_nsec != 0) {
 				state->last_key = key;
 				if (timerfd_settime(state->timerfd, 0,
@@ -309,84 +544,97 @@ static void keyboard_grab_key(void *data,
 		case PRESS_CONSUME:
 		}
 	} else if (key_state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-		xkb_keysym_t keysym = xkb_state_key_get_one_sym(
-				state->xkb_state, key + 8);
-		if ((keysym == XKB_KEY_Shift_L || keysym == XKB_KEY_Shift_R) &&
-				state->shift_only) {
+		struct wlchewing_key released = keymap_key_get_base(
+			state->keymap, state->group, key + 8);
+		if (released.action == KEY_ACTION_SHIFT && state->shift_only) {
 			state->shift_only = false;
 			im_mode_switch(state, !state->forwarding);
 		}
 
 		// find if we should not forward key release
-		struct wlchewing_keysym *mkeysym, *tmp;
-		wl_list_for_each_safe(mkeysym, tmp,
-				&state->pending_handled_keysyms, link) {
-			if (mkeysym->key == key) {
-				wl_list_remove(&mkeysym->link);
-				free(mkeysym);
-				if (key == state->last_key) {
-					state->last_key = 0;
-					if (timerfd_settime(state->timerfd, 0,
-							&timer_disarm,
-							NULL) == -1) {
-						wlchewing_perr(
-							"Failed to disarm timer");
-					}
+		if (keyset_remove(&state->pending_handled_keys, key)) {
+			if (key == state->last_key) {
+				state->last_key = 0;
+				if (timerfd_settime(state->timerfd, 0,
+						&timer_disarm, NULL) == -1) {
+					wlchewing_perr("Failed to disarm timer");
 				}
-				return;
 			}
+			return;
+		}
+		if (state->pending_update) {
+			im_send_update(state);
 		}
 		zwp_virtual_keyboard_v1_key(state->virtual_keyboard, time, key,
 			key_state);
-		wl_list_for_each_safe(mkeysym, tmp,
-				&state->press_sent_keysyms, link) {
-			if (mkeysym->key == key) {
-				wl_list_remove(&mkeysym->link);
-				free(mkeysym);
-			}
+		keyset_remove(&state->press_sent_keys, key);
+		if (!passthrough) {
+			im_maybe_roundtrip(state);
 		}
-		wl_display_roundtrip(state->display);
 	}
 }
 
+static void keyboard_grab_key(void *data,
+		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
+		uint32_t serial, uint32_t time,
+		uint32_t key, uint32_t key_state) {
+	struct wlchewing_state *state = data;
+	if (!state->config.stats) {
+		im_handle_key(state, time, key, key_state);
+		return;
+	}
+	uint64_t start = stats_now_us();
+	// oldest key not yet acked
+	if (!state->key_start_us) {
+		state->key_start_us = start;
+	}
+	im_handle_key(state, time, key, key_state);
+	stats_record(&state->stats.key_handling, start);
+}
+
 static void keyboard_grab_modifiers(void *data,
 		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
 		uint32_t serial, uint32_t mods_depressed,
 		uint32_t mods_latched, uint32_t mods_locked, uint32_t group) {
 	struct wlchewing_state *state = data;
-	xkb_state_update_mask(state->xkb_state, mods_depressed, mods_latched,
-		mods_locked, 0, 0, group);
+	state->mods_depressed = mods_depressed;
+	state->mods_latched = mods_latched;
+	state->mods_locked = mods_locked;
+	state->group = group;
+	state->mods = mods_depressed | mods_latched | mods_locked;
 	// forward modifiers
 	zwp_virtual_keyboard_v1_modifiers(state->virtual_keyboard,
 		mods_depressed, mods_latched, mods_locked, group);
-	wl_display_roundtrip(state->display);
+	// until a key is not in the keymap tables
+	state->xkb_state_stale = true;
+	if (im_passthrough(state)) {
+		return;
+	}
+	im_maybe_roundtrip(state);
 }
 
 static void keyboard_grab_keymap(void *data,
 		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
 		uint32_t format, int32_t fd, uint32_t size) {
 	struct wlchewing_state *state = data;
-	char *keymap = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (state->keymap == NULL || state->keymap_size != size ||
-			strncmp(state->keymap, keymap, size) != 0) {
-		if (!state->config.chewing_use_xkb_default) {
-			struct xkb_keymap *xkb_keymap =
-				xkb_keymap_new_from_buffer(state->xkb_context,
-					keymap, size, XKB_KEYMAP_FORMAT_TEXT_V1,
-					XKB_KEYMAP_COMPILE_NO_FLAGS);
-			xkb_state_unref(state->xkb_state);
-			state->xkb_state = xkb_state_new(xkb_keymap);
-			xkb_keymap_unref(xkb_keymap);
-		}
-		munmap(state->keymap, state->keymap_size);
+	struct wlchewing_keymap *current = wl_list_empty(
+		&state->keymap_cache.lru.nodes) ? NULL : wl_container_of(
+		state->keymap_cache.lru.nodes.next, current, node.link);
+	struct wlchewing_keymap *keymap = keymap_cache_get(
+		&state->keymap_cache, format, fd, size);
+	if (!keymap || keymap == current) {
+		return;
+	}
+	if (keymap->xkb_keymap) {
+		xkb_state_unref(state->xkb_state);
+		state->xkb_state = xkb_state_new(keymap->xkb_keymap);
+		state->xkb_state_stale = true;
 		state->keymap = keymap;
-		state->keymap_size = size;
-		// forward keymap
-		zwp_virtual_keyboard_v1_keymap(state->virtual_keyboard,
-			format, fd, size);
-		wl_display_roundtrip(state->display);
 	}
-	close(fd);
+	// forward keymap
+	zwp_virtual_keyboard_v1_keymap(state->virtual_keyboard,
+		keymap->format, keymap->fd, keymap->size);
+	im_maybe_roundtrip(state);
 }
 
 static void keyboard_grab_repeat_info(void *data,
@@ -416,6 +664,17 @@ static void input_method_activate(void *data,
 		struct zwp_input_method_v2 *input_method) {
 	struct wlchewing_state *state = data;
 	state->pending_activate = true;
+	// content type is reset on activate
+	state->pending_content_hint = ZWP_TEXT_INPUT_V3_CONTENT_HINT_NONE;
+	state->pending_content_purpose = ZWP_TEXT_INPUT_V3_CONTENT_PURPOSE_NORMAL;
+}
+
+static void input_method_content_type(void *data,
+		struct zwp_input_method_v2 *input_method, uint32_t hint,
+		uint32_t purpose) {
+	struct wlchewing_state *state = data;
+	state->pending_content_hint = hint;
+	state->pending_content_purpose = purpose;
 }
 
 static void input_method_deactivate(void *data,
@@ -435,17 +694,32 @@ static void input_method_unavailable(void *data,
 static void input_method_done(void *data,
 		struct zwp_input_method_v2 *input_method) {
 	struct wlchewing_state *state = data;
+	// belongs to the previous state
+	if (state->pending_update) {
+		im_send_update(state);
+	}
 	state->serial++;
+	// first done of the object recreated by vte_hack, what was held
+	// back is still pending
+	state->awaiting_done = false;
+	if (state->pending_activate != state->activated) {
+		im_forget_sent_preedit(state);
+	}
 	if (state->pending_activate && !state->activated) {
-		state->keyboard_grab = zwp_input_method_v2_grab_keyboard(
-			state->input_method);
+		state->keyboard_grab = state->reader ?
+			reader_grab_keyboard(state->reader,
+				state->input_method) :
+			zwp_input_method_v2_grab_keyboard(state->input_method);
 		// sanity check if compositor doesn't really impl it
 		if (!state->keyboard_grab) {
 			wlchewing_err("Failed to grab");
 			exit(EXIT_FAILURE);
 		}
-		zwp_input_method_keyboard_grab_v2_add_listener(
-			state->keyboard_grab, &keyboard_grab_listener, state);
+		if (!state->reader) {
+			zwp_input_method_keyboard_grab_v2_add_listener(
+				state->keyboard_grab, &keyboard_grab_listener,
+				state);
+		}
 	} else if (!state->pending_activate && state->activated) {
 		zwp_input_method_keyboard_grab_v2_release(state->keyboard_grab);
 		state->keyboard_grab = NULL;
@@ -453,7 +727,16 @@ static void input_method_done(void *data,
 		im_release_all_keys(state);
 	}
 	state->activated = state->pending_activate;
-	wl_display_roundtrip(state->display);
+
+	bool bypass = state->activated && im_content_type_bypass(state,
+		state->pending_content_hint, state->pending_content_purpose);
+	if (bypass && !state->bypass && !state->forwarding) {
+		// content type changed within the same activation
+		im_leave_chewing(state);
+	}
+	state->bypass = bypass;
+	state->content_purpose = state->pending_content_purpose;
+	im_maybe_roundtrip(state);
 }
 
 static const struct zwp_input_method_v2_listener input_method_listener = {
@@ -463,31 +746,115 @@ static const struct zwp_input_method_v2_listener input_method_listener = {
 		(typeof(input_method_listener.surrounding_text))noop,
 	.text_change_cause	=
 		(typeof(input_method_listener.text_change_cause))noop,
-	.content_type		=
-		(typeof(input_method_listener.content_type))noop,
+	.content_type		= input_method_content_type,
 	.done			= input_method_done,
 	.unavailable		= input_method_unavailable,
 };
 
+// with --reader-thread, the input method is dispatched on the reader queue
+// and its events are handled in im_handle_events instead
+static void im_get_input_method(struct wlchewing_state *state) {
+	if (state->reader) {
+		state->input_method = reader_get_input_method(state->reader,
+			state->wl_globals.seat);
+		return;
+	}
+	state->input_method = zwp_input_method_manager_v2_get_input_method(
+		state->wl_globals.input_method_manager, state->wl_globals.seat);
+	zwp_input_method_v2_add_listener(state->input_method,
+		&input_method_listener, state);
+}
+
+static void im_handle_event(struct wlchewing_state *state,
+		struct wlchewing_event *event) {
+	bool from_grab = event->type >= EVENT_KEYMAP;
+	if (event->generation != (from_grab ?
+			state->reader->keyboard_grab_generation :
+			state->reader->input_method_generation) ||
+			(from_grab && !state->keyboard_grab)) {
+		// object destroyed after the event was queued
+		if (event->type == EVENT_KEYMAP) {
+			close(event->keymap.fd);
+		}
+		return;
+	}
+	switch (event->type) {
+	case EVENT_ACTIVATE:
+		input_method_activate(state, state->input_method);
+		break;
+	case EVENT_DEACTIVATE:
+		input_method_deactivate(state, state->input_method);
+		break;
+	case EVENT_CONTENT_TYPE:
+		input_method_content_type(state, state->input_method,
+			event->content_type.hint, event->content_type.purpose);
+		break;
+	case EVENT_DONE:
+		input_method_done(state, state->input_method);
+		break;
+	case EVENT_UNAVAILABLE:
+		input_method_unavailable(state, state->input_method);
+		break;
+	case EVENT_KEYMAP:
+		keyboard_grab_keymap(state, state->keyboard_grab,
+			event->keymap.format, event->keymap.fd,
+			event->keymap.size);
+		break;
+	case EVENT_KEY:
+		if (state->config.stats && !state->key_start_us) {
+			// count the time spent in queue
+			state->key_start_us = event->received_us;
+		}
+		keyboard_grab_key(state, state->keyboard_grab, 0,
+			event->key.time, event->key.key, event->key.state);
+		break;
+	case EVENT_MODIFIERS:
+		keyboard_grab_modifiers(state, state->keyboard_grab, 0,
+			event->modifiers.depressed, event->modifiers.latched,
+			event->modifiers.locked, event->modifiers.group);
+		break;
+	case EVENT_REPEAT_INFO:
+		keyboard_grab_repeat_info(state, state->keyboard_grab,
+			event->repeat_info.rate, event->repeat_info.delay);
+		break;
+	}
+}
+
+void im_handle_events(struct wlchewing_state *state) {
+	uint32_t depth = reader_depth(state->reader);
+	if (state->config.stats) {
+		stats_record_depth(&state->stats, depth);
+	}
+	struct wlchewing_event event;
+	// only what was there on wakeup, newer ones come with another wakeup
+	while (depth-- && reader_pop(state->reader, &event)) {
+		if (state->config.stats) {
+			stats_record(&state->stats.queue_wait,
+				event.received_us);
+		}
+		im_handle_event(state, &event);
+	}
+}
+
 void im_release_all_keys(struct wlchewing_state *state) {
-	struct wlchewing_keysym *mkeysym, *tmp;
-	wl_list_for_each_safe(mkeysym, tmp, &state->press_sent_keysyms, link) {
+	uint32_t key;
+	keyset_for_each(key, &state->press_sent_keys) {
 		zwp_virtual_keyboard_v1_key(state->virtual_keyboard,
 			get_millis() - state->millis_offset,
-			mkeysym->key, WL_KEYBOARD_KEY_STATE_RELEASED);
-		wl_list_remove(&mkeysym->link);
-		free(mkeysym);
+			key, WL_KEYBOARD_KEY_STATE_RELEASED);
 	}
+	state->press_sent_keys = (struct wlchewing_keyset){0};
 }
 
 void im_setup(struct wlchewing_state *state) {
 	state->forwarding = state->config.start_eng;
 	sni_notify_new_icon(state->sni);
 
-	state->input_method = zwp_input_method_manager_v2_get_input_method(
-		state->wl_globals.input_method_manager, state->wl_globals.seat);
-	zwp_input_method_v2_add_listener(state->input_method,
-		&input_method_listener, state);
+	if (state->config.reader_thread) {
+		state->reader = reader_start(state->display,
+			state->wl_globals.input_method_manager);
+	}
+	im_get_input_method(state);
 
 	state->virtual_keyboard =
 		zwp_virtual_keyboard_manager_v1_create_virtual_keyboard(
@@ -499,32 +866,49 @@ void im_setup(struct wlchewing_state *state) {
 	struct xkb_keymap *keymap = xkb_keymap_new_from_names(
 		state->xkb_context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
 	state->xkb_state = xkb_state_new(keymap);
+	// --force-default-keymap keeps using this one
+	state->default_keymap = keymap_new(keymap);
+	state->keymap = state->default_keymap;
 	xkb_keymap_unref(keymap);
-	wl_list_init(&state->pending_handled_keysyms);
-	wl_list_init(&state->press_sent_keysyms);
+	keymap_cache_init(&state->keymap_cache, state->xkb_context,
+		!state->config.chewing_use_xkb_default);
 
-	wl_display_roundtrip(state->display);
+	watchdog_roundtrip(state, "setting up input method");
 
 	bottom_panel_init(state);
 }
 
 void im_destory(struct wlchewing_state *state) {
 	chewing_delete(state->chewing);
+	free(state->pending_commit);
+	free(state->preedit.text);
+	free(state->sent_preedit.text);
 	xkb_state_unref(state->xkb_state);
+	keymap_cache_finish(&state->keymap_cache);
+	keymap_destroy(state->default_keymap);
 	xkb_context_unref(state->xkb_context);
+	if (state->keyboard_grab) {
+		zwp_input_method_keyboard_grab_v2_release(state->keyboard_grab);
+	}
 	zwp_input_method_v2_destroy(state->input_method);
-	if (state->bottom_panel) {
-		bottom_panel_destroy(state->bottom_panel);
+	if (state->reader) {
+		reader_stop(state->reader);
+	}
+	if (state->persistent_bottom_panel) {
+		bottom_panel_destroy(state->persistent_bottom_panel);
+		state->persistent_bottom_panel = NULL;
 		state->bottom_panel = NULL;
 	}
+	bottom_panel_finish(state);
 }
 
 static void vte_hack(struct wlchewing_state *state) {
 	zwp_input_method_v2_destroy(state->input_method);
-	state->input_method = zwp_input_method_manager_v2_get_input_method(
-		state->wl_globals.input_method_manager, state->wl_globals.seat);
+	im_get_input_method(state);
 	state->serial = 0;
-	zwp_input_method_v2_add_listener(state->input_method,
-		&input_method_listener, state);
-	wl_display_roundtrip(state->display);
+	state->awaiting_done = true;
+	im_forget_sent_preedit(state);
+	state->stats.vte_hacks++;
+	// events for the new object are dispatched by the main loop
+	im_maybe_roundtrip(state);
 }
@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "keymap.h"
+#include "wlchewing.h"
+#include "xmem.h"
+
+static struct wlchewing_key classify(xkb_keysym_t keysym) {
+	struct wlchewing_key key = {
+		.keysym = keysym,
+		.action = KEY_ACTION_NONE,
+		.candidate = -1,
+	};
+	switch (keysym) {
+	case XKB_KEY_Shift_L:
+	case XKB_KEY_Shift_R:
+		key.action = KEY_ACTION_SHIFT;
+		break;
+	case XKB_KEY_BackSpace:
+		key.action = KEY_ACTION_BACKSPACE;
+		break;
+	case XKB_KEY_Delete:
+	case XKB_KEY_KP_Delete:
+		key.action = KEY_ACTION_DELETE;
+		break;
+	case XKB_KEY_Return:
+	case XKB_KEY_KP_Enter:
+		key.action = KEY_ACTION_ENTER;
+		break;
+	case XKB_KEY_Left:
+	case XKB_KEY_KP_Left:
+		key.action = KEY_ACTION_LEFT;
+		break;
+	case XKB_KEY_Right:
+	case XKB_KEY_KP_Right:
+		key.action = KEY_ACTION_RIGHT;
+		break;
+	case XKB_KEY_Home:
+		key.action = KEY_ACTION_HOME;
+		break;
+	case XKB_KEY_End:
+		key.action = KEY_ACTION_END;
+		break;
+	case XKB_KEY_Up:
+	case XKB_KEY_KP_Up:
+		key.action = KEY_ACTION_UP;
+		break;
+	case XKB_KEY_Down:
+	case XKB_KEY_KP_Down:
+		key.action = KEY_ACTION_DOWN;
+		break;
+	case XKB_KEY_Page_Up:
+	case XKB_KEY_KP_Page_Up:
+		key.action = KEY_ACTION_PAGE_UP;
+		break;
+	case XKB_KEY_Page_Down:
+	case XKB_KEY_KP_Page_Down:
+		key.action = KEY_ACTION_PAGE_DOWN;
+		break;
+	case XKB_KEY_KP_1 ... XKB_KEY_KP_9:
+		key.candidate = keysym - XKB_KEY_KP_1;
+		break;
+	case XKB_KEY_KP_0:
+		key.candidate = 9;
+		break;
+	default:
+		if (keysym >= XKB_KEY_space && keysym <= XKB_KEY_asciitilde) {
+			key.action = KEY_ACTION_PRINTABLE;
+			if (keysym >= XKB_KEY_1 && keysym <= XKB_KEY_9) {
+				key.candidate = keysym - XKB_KEY_1;
+			} else if (keysym == XKB_KEY_0) {
+				key.candidate = 9;
+			}
+		}
+	}
+	return key;
+}
+
+static xkb_mod_mask_t mod_mask(struct xkb_keymap *xkb_keymap,
+		const char *name) {
+	xkb_mod_index_t index = xkb_keymap_mod_get_index(xkb_keymap, name);
+	return index == XKB_MOD_INVALID ? 0 : 1u << index;
+}
+
+static uint16_t keymap_type(struct wlchewing_keymap *keymap,
+		struct xkb_keymap *xkb_keymap, xkb_keycode_t keycode,
+		xkb_layout_index_t layout) {
+	// compared whole, padding included
+	struct wlchewing_key_type type;
+	memset(&type, 0, sizeof(type));
+	type.complete = true;
+	xkb_level_index_t levels =
+		xkb_keymap_num_levels_for_key(xkb_keymap, keycode, layout);
+	for (xkb_level_index_t level = 0; level < levels; level++) {
+		xkb_mod_mask_t masks[keymap_max_entries];
+		size_t n = xkb_keymap_key_get_mods_for_level(xkb_keymap,
+			keycode, layout, level, masks, keymap_max_entries);
+		for (size_t i = 0; i < n; i++) {
+			if (level >= keymap_max_levels ||
+					type.count == keymap_max_entries) {
+				type.complete = false;
+				break;
+			}
+			type.mask |= masks[i];
+			type.mods[type.count] = masks[i];
+			type.levels[type.count++] = level;
+		}
+	}
+	// few distinct ones, shared by most keys
+	for (size_t i = 0; i < keymap->type_count; i++) {
+		if (memcmp(&keymap->types[i], &type, sizeof(type)) == 0) {
+			return i;
+		}
+	}
+	keymap->types = xrealloc(keymap->types,
+		(keymap->type_count + 1) * sizeof(struct wlchewing_key_type));
+	keymap->types[keymap->type_count] = type;
+	return keymap->type_count++;
+}
+
+static void keymap_build(struct wlchewing_keymap *keymap,
+		struct xkb_keymap *xkb_keymap) {
+	keymap->xkb_keymap = xkb_keymap_ref(xkb_keymap);
+	keymap->min_keycode = xkb_keymap_min_keycode(xkb_keymap);
+	keymap->max_keycode = xkb_keymap_max_keycode(xkb_keymap);
+	keymap->num_layouts = xkb_keymap_num_layouts(xkb_keymap);
+	keymap->ctrl_mask = mod_mask(xkb_keymap, XKB_MOD_NAME_CTRL);
+	keymap->alt_mask = mod_mask(xkb_keymap, XKB_MOD_NAME_ALT);
+	keymap->logo_mask = mod_mask(xkb_keymap, XKB_MOD_NAME_LOGO);
+	keymap->lock_mask = mod_mask(xkb_keymap, XKB_MOD_NAME_CAPS);
+
+	size_t keycodes = keymap->max_keycode - keymap->min_keycode + 1;
+	size_t per_key = keymap->num_layouts * keymap_max_levels;
+	keymap->keys = xcalloc(keycodes * per_key,
+		sizeof(struct wlchewing_key));
+	keymap->caps_keys = xcalloc(keycodes * per_key,
+		sizeof(struct wlchewing_key));
+	keymap->key_types = xcalloc(keycodes * keymap->num_layouts,
+		sizeof(uint16_t));
+	for (xkb_keycode_t keycode = keymap->min_keycode;
+			keycode <= keymap->max_keycode; keycode++) {
+		struct wlchewing_key *keys = &keymap->keys[
+			(keycode - keymap->min_keycode) * per_key];
+		struct wlchewing_key *caps_keys = &keymap->caps_keys[
+			(keycode - keymap->min_keycode) * per_key];
+		xkb_layout_index_t layouts =
+			xkb_keymap_num_layouts_for_key(xkb_keymap, keycode);
+		for (xkb_layout_index_t layout = 0;
+				layout < keymap->num_layouts; layout++) {
+			keymap->key_types[(keycode - keymap->min_keycode) *
+				keymap->num_layouts + layout] = keymap_type(
+				keymap, xkb_keymap, keycode,
+				layouts ? layout % layouts : 0);
+			for (xkb_level_index_t level = 0;
+					level < keymap_max_levels; level++) {
+				const xkb_keysym_t *syms;
+				// keys with less layouts wrap around
+				int n = layouts ? xkb_keymap_key_get_syms_by_level(
+					xkb_keymap, keycode, layout % layouts,
+					level, &syms) : 0;
+				keys[layout * keymap_max_levels + level] =
+					classify(n == 1 ? syms[0] :
+						XKB_KEY_NoSymbol);
+				caps_keys[layout * keymap_max_levels + level] =
+					classify(n == 1 ?
+						xkb_keysym_to_upper(syms[0]) :
+						XKB_KEY_NoSymbol);
+			}
+		}
+	}
+}
+
+struct wlchewing_keymap *keymap_new(struct xkb_keymap *xkb_keymap) {
+	struct wlchewing_keymap *keymap = xcalloc(1,
+		sizeof(struct wlchewing_keymap));
+	keymap->fd = -1;
+	keymap_build(keymap, xkb_keymap);
+	return keymap;
+}
+
+void keymap_destroy(struct wlchewing_keymap *keymap) {
+	if (keymap->xkb_keymap) {
+		xkb_keymap_unref(keymap->xkb_keymap);
+	}
+	if (keymap->fd >= 0) {
+		close(keymap->fd);
+	}
+	free(keymap->keys);
+	free(keymap->caps_keys);
+	free(keymap->key_types);
+	free(keymap->types);
+	free(keymap);
+}
+
+static void keymap_evict(struct wlchewing_lru_node *node) {
+	struct wlchewing_keymap *keymap = wl_container_of(node, keymap, node);
+	keymap_destroy(keymap);
+}
+
+struct keymap_key {
+	uint32_t format, size;
+};
+
+static bool keymap_match(const struct wlchewing_lru_node *node,
+		const void *data) {
+	const struct wlchewing_keymap *keymap =
+		wl_container_of(node, keymap, node);
+	const struct keymap_key *key = data;
+	return keymap->size == key->size && keymap->format == key->format;
+}
+
+void keymap_cache_init(struct wlchewing_keymap_cache *cache,
+		struct xkb_context *xkb_context, bool compile) {
+	cache->xkb_context = xkb_context;
+	cache->compile = compile;
+	lru_init(&cache->lru, keymap_cache_size, keymap_evict);
+}
+
+struct wlchewing_keymap *keymap_cache_get(struct wlchewing_keymap_cache *cache,
+		uint32_t format, int fd, uint32_t size) {
+	char *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (text == MAP_FAILED) {
+		wlchewing_perr("Failed to mmap keymap");
+		close(fd);
+		return NULL;
+	}
+	uint64_t hash = fnv1a(fnv1a_basis, text, size);
+
+	const struct keymap_key key = {format, size};
+	struct wlchewing_lru_node *node = lru_find(&cache->lru, hash,
+		keymap_match, &key);
+	if (node) {
+		munmap(text, size);
+		close(fd);
+		struct wlchewing_keymap *keymap =
+			wl_container_of(node, keymap, node);
+		return keymap;
+	}
+
+	struct xkb_keymap *xkb_keymap = NULL;
+	if (cache->compile) {
+		xkb_keymap = xkb_keymap_new_from_buffer(cache->xkb_context,
+			text, size, XKB_KEYMAP_FORMAT_TEXT_V1,
+			XKB_KEYMAP_COMPILE_NO_FLAGS);
+		if (!xkb_keymap) {
+			wlchewing_err("Failed to compile keymap");
+			munmap(text, size);
+			close(fd);
+			return NULL;
+		}
+	}
+	munmap(text, size);
+
+	struct wlchewing_keymap *keymap = xcalloc(1,
+		sizeof(struct wlchewing_keymap));
+	keymap->node.hash = hash;
+	keymap->node.bytes = 1;
+	keymap->format = format;
+	keymap->size = size;
+	keymap->fd = fd;
+	if (xkb_keymap) {
+		keymap_build(keymap, xkb_keymap);
+		xkb_keymap_unref(xkb_keymap);
+	}
+	lru_insert(&cache->lru, &keymap->node);
+	return keymap;
+}
+
+void keymap_cache_finish(struct wlchewing_keymap_cache *cache) {
+	lru_finish(&cache->lru);
+}
+
+bool keymap_key_get(struct wlchewing_keymap *keymap, xkb_mod_mask_t mods,
+		xkb_layout_index_t group, xkb_keycode_t keycode,
+		struct wlchewing_key *key) {
+	if (keycode < keymap->min_keycode || keycode > keymap->max_keycode ||
+			!keymap->num_layouts) {
+		return false;
+	}
+	size_t index = (keycode - keymap->min_keycode) * keymap->num_layouts +
+		group % keymap->num_layouts;
+	const struct wlchewing_key_type *type =
+		&keymap->types[keymap->key_types[index]];
+	if (!type->complete) {
+		return false;
+	}
+	// the first entry matching, as xkbcommon picks it
+	xkb_mod_mask_t selecting = mods & type->mask;
+	xkb_level_index_t level = 0;
+	for (int i = 0; i < type->count; i++) {
+		if (type->mods[i] == selecting) {
+			level = type->levels[i];
+			break;
+		}
+	}
+	// capitalization transformation of xkbcommon
+	const struct wlchewing_key *keys = (mods & keymap->lock_mask) &&
+		!(type->mask & keymap->lock_mask) ?
+		keymap->caps_keys : keymap->keys;
+	*key = keys[index * keymap_max_levels + level];
+	return true;
+}
+
+struct wlchewing_key keymap_key_get_xkb(struct xkb_state *xkb_state,
+		xkb_keycode_t keycode) {
+	return classify(xkb_state_key_get_one_sym(xkb_state, keycode));
+}
+
+struct wlchewing_key keymap_key_get_base(struct wlchewing_keymap *keymap,
+		xkb_layout_index_t group, xkb_keycode_t keycode) {
+	if (keycode < keymap->min_keycode || keycode > keymap->max_keycode ||
+			!keymap->num_layouts) {
+		return classify(XKB_KEY_NoSymbol);
+	}
+	return keymap->keys[(keycode - keymap->min_keycode) *
+		keymap->num_layouts * keymap_max_levels +
+		(group % keymap->num_layouts) * keymap_max_levels];
+}
@@ -0,0 +1,102 @@
+#ifndef KEYMAP_H
+#define KEYMAP_H
+
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "lru.h"
+
+// what a keysym means to us, so that the key path needs no keysym switch
+enum key_action {
+	KEY_ACTION_NONE = 0,
+	KEY_ACTION_PRINTABLE,
+	KEY_ACTION_SHIFT,
+	KEY_ACTION_BACKSPACE,
+	KEY_ACTION_DELETE,
+	KEY_ACTION_ENTER,
+	KEY_ACTION_LEFT,
+	KEY_ACTION_RIGHT,
+	KEY_ACTION_HOME,
+	KEY_ACTION_END,
+	KEY_ACTION_UP,
+	KEY_ACTION_DOWN,
+	KEY_ACTION_PAGE_UP,
+	KEY_ACTION_PAGE_DOWN,
+};
+
+struct wlchewing_key {
+	xkb_keysym_t keysym;
+	uint8_t action; // enum key_action
+	int8_t candidate; // candidate offset selected by number keys, or -1
+};
+
+static constexpr int keymap_max_levels = 8;
+static constexpr int keymap_max_entries = 16;
+
+// levels selected by modifiers, as a key type of xkbcommon
+struct wlchewing_key_type {
+	xkb_mod_mask_t mask; // modifiers the level depends on
+	bool complete; // otherwise left to xkbcommon
+	uint8_t count;
+	uint8_t levels[keymap_max_entries];
+	xkb_mod_mask_t mods[keymap_max_entries];
+};
+
+struct wlchewing_keymap {
+	// as received from compositor, to be forwarded to virtual keyboard
+	struct wlchewing_lru_node node; // hash of the text
+	uint32_t format, size;
+	int fd;
+
+	// not compiled with --force-default-keymap
+	struct xkb_keymap *xkb_keymap;
+	xkb_keycode_t min_keycode, max_keycode;
+	xkb_layout_index_t num_layouts;
+	xkb_mod_mask_t ctrl_mask, alt_mask, logo_mask, lock_mask;
+	// [keycode - min_keycode][layout][level]
+	struct wlchewing_key *keys;
+	// as keys, capitalized for Caps Lock not taken by the key type
+	struct wlchewing_key *caps_keys;
+	// [keycode - min_keycode][layout], into types
+	uint16_t *key_types;
+	struct wlchewing_key_type *types;
+	size_t type_count;
+};
+
+static constexpr int keymap_cache_size = 4;
+
+struct wlchewing_keymap_cache {
+	struct xkb_context *xkb_context;
+	bool compile;
+
+	// wlchewing_keymap, counted rather than sized
+	struct wlchewing_lru lru;
+};
+
+struct wlchewing_keymap *keymap_new(struct xkb_keymap *xkb_keymap);
+
+void keymap_destroy(struct wlchewing_keymap *keymap);
+
+// shift level of the key ignored, no xkb_state needed
+struct wlchewing_key keymap_key_get_base(struct wlchewing_keymap *keymap,
+	xkb_layout_index_t group, xkb_keycode_t keycode);
+
+void keymap_cache_init(struct wlchewing_keymap_cache *cache,
+	struct xkb_context *xkb_context, bool compile);
+
+// takes ownership of fd, returns NULL on failure
+struct wlchewing_keymap *keymap_cache_get(struct wlchewing_keymap_cache *cache,
+	uint32_t format, int fd, uint32_t size);
+
+void keymap_cache_finish(struct wlchewing_keymap_cache *cache);
+
+// from the tables only, false for keys they cannot resolve
+bool keymap_key_get(struct wlchewing_keymap *keymap, xkb_mod_mask_t mods,
+	xkb_layout_index_t group, xkb_keycode_t keycode,
+	struct wlchewing_key *key);
+
+// through xkbcommon, for what keymap_key_get cannot resolve
+struct wlchewing_key keymap_key_get_xkb(struct xkb_state *xkb_state,
+	xkb_keycode_t keycode);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef KEYSET_H
+#define KEYSET_H
+
+#include <linux/input-event-codes.h>
+#include <stdint.h>
+
+// set of evdev keycodes, no allocation and O(1) updates
+struct wlchewing_keyset {
+	uint64_t bits[(KEY_CNT + 63) / 64];
+};
+
+[[maybe_unused]] static inline bool keyset_has(
+		const struct wlchewing_keyset *set, uint32_t key) {
+	return key < KEY_CNT && (set->bits[key / 64] >> (key % 64)) & 1;
+}
+
+[[maybe_unused]] static inline void keyset_add(
+		struct wlchewing_keyset *set, uint32_t key) {
+	if (key < KEY_CNT) {
+		set->bits[key / 64] |= UINT64_C(1) << (key % 64);
+	}
+}
+
+// returns whether key was in the set
+[[maybe_unused]] static inline bool keyset_remove(
+		struct wlchewing_keyset *set, uint32_t key) {
+	if (!keyset_has(set, key)) {
+		return false;
+	}
+	set->bits[key / 64] &= ~(UINT64_C(1) << (key % 64));
+	return true;
+}
+
+#define keyset_for_each(key, set) \
+	for (uint32_t _word = 0; _word < sizeof((set)->bits) / sizeof((set)->bits[0]); _word++) \
+		for (uint64_t _rest = (set)->bits[_word]; \
+			_rest && ((key) = _word * 64 + __builtin_ctzll(_rest), true); \
+			_rest &= _rest - 1)
+
+#endif
@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <pango/pangocairo.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client-protocol.h>
+
+#include "buffer.h"
+#include "layout-cache.h"
+#include "xmem.h"
+
+static cairo_subpixel_order_t subpixel_to_cairo[] = {
+	[WL_OUTPUT_SUBPIXEL_UNKNOWN]		= CAIRO_SUBPIXEL_ORDER_DEFAULT,
+	[WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB]	= CAIRO_SUBPIXEL_ORDER_RGB,
+	[WL_OUTPUT_SUBPIXEL_HORIZONTAL_BGR]	= CAIRO_SUBPIXEL_ORDER_BGR,
+	[WL_OUTPUT_SUBPIXEL_VERTICAL_RGB]	= CAIRO_SUBPIXEL_ORDER_VRGB,
+	[WL_OUTPUT_SUBPIXEL_VERTICAL_BGR]	= CAIRO_SUBPIXEL_ORDER_VBGR,
+};
+
+// pango keeps no account of it, roughly what a short line costs
+static size_t entry_cost(size_t len) {
+	return sizeof(struct wlchewing_layout_entry) + len + 1 +
+		512 + 32 * len;
+}
+
+struct layout_key {
+	enum layout_kind kind;
+	int32_t scale, subpixel;
+	unsigned font_hash;
+	const char *text;
+};
+
+static uint64_t key_hash(const struct layout_key *key) {
+	const int32_t head[] = {key->kind, key->scale, key->subpixel,
+		key->font_hash};
+	return fnv1a(fnv1a(fnv1a_basis, head, sizeof(head)), key->text,
+		strlen(key->text));
+}
+
+static bool key_match(const struct wlchewing_lru_node *node,
+		const void *data) {
+	const struct wlchewing_layout_entry *entry =
+		wl_container_of(node, entry, node);
+	const struct layout_key *key = data;
+	return entry->kind == key->kind && entry->scale == key->scale &&
+		entry->subpixel == key->subpixel &&
+		entry->font_hash == key->font_hash &&
+		strcmp(entry->text, key->text) == 0;
+}
+
+static void entry_destroy(struct wlchewing_lru_node *node) {
+	struct wlchewing_layout_entry *entry =
+		wl_container_of(node, entry, node);
+	g_object_unref(entry->layout);
+	free(entry);
+}
+
+struct wlchewing_layout_cache *layout_cache_new(PangoLayout *text_layout,
+		PangoLayout *key_hint_layout, size_t max_bytes) {
+	struct wlchewing_layout_cache *cache = xcalloc(1,
+		sizeof(struct wlchewing_layout_cache));
+	cache->templates[LAYOUT_TEXT] = text_layout;
+	cache->templates[LAYOUT_KEY_HINT] = key_hint_layout;
+	const PangoFontDescription *desc =
+		pango_layout_get_font_description(text_layout);
+	cache->font_hash = desc ? pango_font_description_hash(desc) : 0;
+	wl_list_init(&cache->contexts);
+	lru_init(&cache->lru, max_bytes, entry_destroy);
+	return cache;
+}
+
+void layout_cache_destroy(struct wlchewing_layout_cache *cache) {
+	lru_finish(&cache->lru);
+	struct wlchewing_layout_context *context, *tmp_context;
+	wl_list_for_each_safe(context, tmp_context, &cache->contexts, link) {
+		wl_list_remove(&context->link);
+		g_object_unref(context->context);
+		free(context);
+	}
+	free(cache);
+}
+
+static PangoContext *layout_cache_context(struct wlchewing_layout_cache *cache,
+		int32_t scale, int32_t subpixel) {
+	struct wlchewing_layout_context *context;
+	wl_list_for_each(context, &cache->contexts, link) {
+		if (context->scale == scale && context->subpixel == subpixel) {
+			return context->context;
+		}
+	}
+	context = xcalloc(1, sizeof(struct wlchewing_layout_context));
+	context->scale = scale;
+	context->subpixel = subpixel;
+	context->context = pango_font_map_create_context(
+		pango_context_get_font_map(pango_layout_get_context(
+		cache->templates[LAYOUT_TEXT])));
+	assert(context->context);
+
+	// shaped as it will be drawn to the buffer
+	cairo_surface_t *surface = cairo_image_surface_create(
+		CAIRO_FORMAT_ARGB32, 1, 1);
+	cairo_t *cairo = cairo_create(surface);
+	cairo_surface_destroy(surface);
+	cairo_scale(cairo, (double)scale / scale_unit,
+		(double)scale / scale_unit);
+	cairo_font_options_t *opt = cairo_font_options_create();
+	if (subpixel == WL_OUTPUT_SUBPIXEL_NONE) {
+		cairo_font_options_set_antialias(opt, CAIRO_ANTIALIAS_GRAY);
+	} else {
+		cairo_font_options_set_antialias(opt, CAIRO_ANTIALIAS_SUBPIXEL);
+		cairo_font_options_set_subpixel_order(opt,
+			subpixel_to_cairo[subpixel]);
+	}
+	pango_cairo_context_set_font_options(context->context, opt);
+	cairo_font_options_destroy(opt);
+	pango_cairo_update_context(cairo, context->context);
+	cairo_destroy(cairo);
+
+	wl_list_insert(&cache->contexts, &context->link);
+	return context->context;
+}
+
+PangoLayout *layout_cache_layout(struct wlchewing_layout_cache *cache,
+		enum layout_kind kind, int32_t scale, int32_t subpixel) {
+	PangoLayout *template = cache->templates[kind];
+	PangoLayout *layout = pango_layout_new(layout_cache_context(cache,
+		scale, subpixel));
+	pango_layout_set_font_description(layout,
+		pango_layout_get_font_description(template));
+	pango_layout_set_attributes(layout,
+		pango_layout_get_attributes(template));
+	return layout;
+}
+
+struct wlchewing_layout_entry *layout_cache_get(
+		struct wlchewing_layout_cache *cache, enum layout_kind kind,
+		const char *text, int32_t scale, int32_t subpixel) {
+	const struct layout_key key = {kind, scale, subpixel, cache->font_hash,
+		text};
+	uint64_t hash = key_hash(&key);
+	struct wlchewing_lru_node *node = lru_find(&cache->lru, hash,
+		key_match, &key);
+	if (node) {
+		struct wlchewing_layout_entry *entry =
+			wl_container_of(node, entry, node);
+		return entry;
+	}
+
+	size_t len = strlen(text);
+	struct wlchewing_layout_entry *entry = xcalloc(1,
+		sizeof(struct wlchewing_layout_entry) + len + 1);
+	memcpy(entry->text, text, len);
+	entry->node.hash = hash;
+	entry->kind = kind;
+	entry->scale = scale;
+	entry->subpixel = subpixel;
+	entry->font_hash = cache->font_hash;
+	entry->node.bytes = entry_cost(len);
+
+	entry->layout = layout_cache_layout(cache, kind, scale, subpixel);
+	pango_layout_set_text(entry->layout, text, len);
+	// shapes it
+	pango_layout_get_pixel_size(entry->layout, &entry->width,
+		&entry->height);
+	lru_insert(&cache->lru, &entry->node);
+	return entry;
+}
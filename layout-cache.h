@@ -0,0 +1,56 @@
+#ifndef LAYOUT_CACHE_H
+#define LAYOUT_CACHE_H
+
+#include <pango/pango.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+#include "lru.h"
+
+enum layout_kind {
+	LAYOUT_TEXT = 0,
+	LAYOUT_KEY_HINT,
+	LAYOUT_KINDS,
+};
+
+struct wlchewing_layout_entry {
+	struct wlchewing_lru_node node; // bytes estimated
+	enum layout_kind kind;
+	int32_t scale, subpixel;
+	unsigned font_hash;
+	PangoLayout *layout; // shaped already
+	int width, height;
+	char text[];
+};
+
+// pango context set up for one scale and subpixel order
+struct wlchewing_layout_context {
+	int32_t scale, subpixel;
+	PangoContext *context;
+	struct wl_list link;
+};
+
+// shaped candidates kept across panel openings, render worker only
+struct wlchewing_layout_cache {
+	PangoLayout *templates[LAYOUT_KINDS]; // font and attributes
+	unsigned font_hash;
+	struct wl_list contexts; // struct wlchewing_layout_context
+	struct wlchewing_lru lru; // struct wlchewing_layout_entry
+};
+
+struct wlchewing_layout_cache *layout_cache_new(PangoLayout *text_layout,
+	PangoLayout *key_hint_layout, size_t max_bytes);
+
+void layout_cache_destroy(struct wlchewing_layout_cache *cache);
+
+// new one without text, not cached
+PangoLayout *layout_cache_layout(struct wlchewing_layout_cache *cache,
+	enum layout_kind kind, int32_t scale, int32_t subpixel);
+
+// valid until the next lookup
+struct wlchewing_layout_entry *layout_cache_get(
+	struct wlchewing_layout_cache *cache, enum layout_kind kind,
+	const char *text, int32_t scale, int32_t subpixel);
+
+#endif
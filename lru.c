@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lru.h"
+#include "xmem.h"
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ ((const uint8_t *)data)[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+void lru_init(struct wlchewing_lru *lru, size_t max_bytes,
+		void (*destroy)(struct wlchewing_lru_node *node)) {
+	lru->bucket_count = 64;
+	lru->buckets = xcalloc(lru->bucket_count,
+		sizeof(struct wlchewing_lru_node *));
+	lru->count = 0;
+	wl_list_init(&lru->nodes);
+	lru->bytes = 0;
+	lru->max_bytes = max_bytes;
+	lru->destroy = destroy;
+}
+
+void lru_clear(struct wlchewing_lru *lru) {
+	struct wlchewing_lru_node *node, *tmp;
+	wl_list_for_each_safe(node, tmp, &lru->nodes, link) {
+		wl_list_remove(&node->link);
+		lru->destroy(node);
+	}
+	memset(lru->buckets, 0,
+		lru->bucket_count * sizeof(struct wlchewing_lru_node *));
+	lru->count = 0;
+	lru->bytes = 0;
+}
+
+void lru_finish(struct wlchewing_lru *lru) {
+	lru_clear(lru);
+	free(lru->buckets);
+	lru->buckets = NULL;
+}
+
+struct wlchewing_lru_node *lru_find(struct wlchewing_lru *lru, uint64_t hash,
+		bool (*match)(const struct wlchewing_lru_node *node, const void *key),
+		const void *key) {
+	struct wlchewing_lru_node *node =
+		lru->buckets[hash & (lru->bucket_count - 1)];
+	for (; node; node = node->next) {
+		if (node->hash == hash && match(node, key)) {
+			atomic_fetch_add_explicit(&lru->hits, 1,
+				memory_order_relaxed);
+			wl_list_remove(&node->link);
+			wl_list_insert(&lru->nodes, &node->link);
+			return node;
+		}
+	}
+	atomic_fetch_add_explicit(&lru->misses, 1, memory_order_relaxed);
+	return NULL;
+}
+
+static void lru_unlink(struct wlchewing_lru *lru,
+		struct wlchewing_lru_node *node) {
+	struct wlchewing_lru_node **p =
+		&lru->buckets[node->hash & (lru->bucket_count - 1)];
+	while (*p != node) {
+		p = &(*p)->next;
+	}
+	*p = node->next;
+	wl_list_remove(&node->link);
+	lru->count--;
+	lru->bytes -= node->bytes;
+}
+
+static void lru_grow(struct wlchewing_lru *lru) {
+	size_t bucket_count = lru->bucket_count * 2;
+	struct wlchewing_lru_node **buckets = xcalloc(bucket_count,
+		sizeof(struct wlchewing_lru_node *));
+	for (size_t i = 0; i < lru->bucket_count; i++) {
+		struct wlchewing_lru_node *node = lru->buckets[i];
+		while (node) {
+			struct wlchewing_lru_node *next = node->next;
+			size_t bucket = node->hash & (bucket_count - 1);
+			node->next = buckets[bucket];
+			buckets[bucket] = node;
+			node = next;
+		}
+	}
+	free(lru->buckets);
+	lru->buckets = buckets;
+	lru->bucket_count = bucket_count;
+}
+
+void lru_insert(struct wlchewing_lru *lru, struct wlchewing_lru_node *node) {
+	if (lru->count >= lru->bucket_count) {
+		lru_grow(lru);
+	}
+	size_t bucket = node->hash & (lru->bucket_count - 1);
+	node->next = lru->buckets[bucket];
+	lru->buckets[bucket] = node;
+	wl_list_insert(&lru->nodes, &node->link);
+	lru->count++;
+	lru->bytes += node->bytes;
+
+	while (lru->bytes > lru->max_bytes && lru->count > 1) {
+		struct wlchewing_lru_node *oldest = wl_container_of(
+			lru->nodes.prev, oldest, link);
+		lru_unlink(lru, oldest);
+		lru->destroy(oldest);
+		atomic_fetch_add_explicit(&lru->evictions, 1,
+			memory_order_relaxed);
+	}
+}
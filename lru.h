@@ -0,0 +1,52 @@
+#ifndef LRU_H
+#define LRU_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-util.h>
+
+// fnv-1a, chained from fnv1a_basis
+static constexpr uint64_t fnv1a_basis = 0xcbf29ce484222325;
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t size);
+
+// embedded in cached entries
+struct wlchewing_lru_node {
+	uint64_t hash;
+	size_t bytes; // counted against max_bytes
+	struct wlchewing_lru_node *next; // in bucket
+	struct wl_list link; // most recently used first
+};
+
+// hash table evicting least recently used entries past max_bytes
+struct wlchewing_lru {
+	struct wlchewing_lru_node **buckets;
+	size_t bucket_count; // power of 2
+	size_t count;
+	struct wl_list nodes; // struct wlchewing_lru_node
+	size_t bytes, max_bytes;
+	// frees the entry, already unlinked
+	void (*destroy)(struct wlchewing_lru_node *node);
+
+	// read by the main thread for stats
+	_Atomic uint64_t hits, misses, evictions;
+};
+
+void lru_init(struct wlchewing_lru *lru, size_t max_bytes,
+	void (*destroy)(struct wlchewing_lru_node *node));
+
+// destroys every entry
+void lru_clear(struct wlchewing_lru *lru);
+
+void lru_finish(struct wlchewing_lru *lru);
+
+// made most recently used, NULL if none matches
+struct wlchewing_lru_node *lru_find(struct wlchewing_lru *lru, uint64_t hash,
+	bool (*match)(const struct wlchewing_lru_node *node, const void *key),
+	const void *key);
+
+// hash and bytes set, may evict any entry but this one
+void lru_insert(struct wlchewing_lru *lru, struct wlchewing_lru_node *node);
+
+#endif
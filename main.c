@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 #include <wayland-client-protocol.h>
@@ -22,6 +23,7 @@ struct global_map_el {
 	const struct wl_interface *interface;
 	uint32_t version;
 	void **dest;
+	bool optional; // features go without
 } globals[] = {
 	{
 		&wl_compositor_interface, 6,
@@ -43,13 +45,35 @@ struct global_map_el {
 		&zwlr_layer_shell_v1_interface, 1,
 		(void **)&global_state.wl_globals.layer_shell,
 	},
+	{
+		&wl_subcompositor_interface, 1,
+		(void **)&global_state.wl_globals.subcompositor, true,
+	},
+	{
+		&wp_viewporter_interface, 1,
+		(void **)&global_state.wl_globals.viewporter, true,
+	},
+	{
+		&wp_single_pixel_buffer_manager_v1_interface, 1,
+		(void **)&global_state.wl_globals.single_pixel_buffer_manager,
+		true,
+	},
+	{
+		&wp_fractional_scale_manager_v1_interface, 1,
+		(void **)&global_state.wl_globals.fractional_scale_manager,
+		true,
+	},
 	{NULL},
 };
 
-static void handle_signal(int signo) {
-	im_release_all_keys(&global_state);
-	wl_display_roundtrip(global_state.display);
-	raise(signo);
+static void teardown(struct wlchewing_state *state) {
+	im_release_all_keys(state);
+	watchdog_roundtrip(state, "releasing keys");
+	if (state->config.stats) {
+		stats_dump(state, stderr);
+	}
+	im_destory(state);
+	wl_display_disconnect(state->display);
 }
 
 static const struct wl_output_listener output_listener;
@@ -202,11 +226,43 @@ static void pointer_axis_discrete(void *data, struct wl_pointer *pointer,
 	im_candidates_move_by(state, discrete);
 }
 
+static void pointer_enter(void *data, struct wl_pointer *pointer,
+		uint32_t serial, struct wl_surface *surface,
+		wl_fixed_t x, wl_fixed_t y) {
+	struct wlchewing_state *state = data;
+	state->pointer_surface = surface;
+	state->pointer_x = wl_fixed_to_double(x);
+}
+
+static void pointer_leave(void *data, struct wl_pointer *pointer,
+		uint32_t serial, struct wl_surface *surface) {
+	struct wlchewing_state *state = data;
+	state->pointer_surface = NULL;
+}
+
+static void pointer_motion(void *data, struct wl_pointer *pointer,
+		uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+	struct wlchewing_state *state = data;
+	state->pointer_x = wl_fixed_to_double(x);
+}
+
 static void pointer_button(void *data, struct wl_pointer *pointer,
-		uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
-	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
-		if (button == BTN_MIDDLE || button == BTN_RIGHT) {
-			im_commit_candidate(data, 0);
+		uint32_t serial, uint32_t time, uint32_t button,
+		uint32_t button_state) {
+	struct wlchewing_state *state = data;
+	if (button_state != WL_POINTER_BUTTON_STATE_PRESSED) {
+		return;
+	}
+	if (button == BTN_MIDDLE || button == BTN_RIGHT) {
+		im_commit_candidate(state, 0);
+	} else if (button == BTN_LEFT && state->bottom_panel &&
+			state->pointer_surface ==
+			state->bottom_panel->wl_surface) {
+		int index = bottom_panel_hit_test(state->bottom_panel,
+			state->pointer_x);
+		if (index >= 0) {
+			im_commit_candidate(state, index -
+				state->bottom_panel->selected_index);
 		}
 	}
 }
@@ -271,9 +327,9 @@ static void pointer_axis_source(void *data, struct wl_pointer *pointer,
 }
 
 static const struct wl_pointer_listener pointer_listener = {
-	.enter		= (typeof(pointer_listener.enter))noop,
-	.leave		= (typeof(pointer_listener.leave))noop,
-	.motion		= (typeof(pointer_listener.motion))noop,
+	.enter		= pointer_enter,
+	.leave		= pointer_leave,
+	.motion		= pointer_motion,
 	.button		= pointer_button,
 	.axis		= pointer_axis,
 	.frame		= pointer_frame,
@@ -298,6 +354,17 @@ static const struct wl_seat_listener seat_listener = {
 	.name		= (typeof(seat_listener.name))noop,
 };
 
+// with the reader thread, it reads the socket and we only write
+static inline void watch_display(int ep, int op, int fd, bool in, bool out) {
+	struct epoll_event epoll = {
+		.events = (in ? EPOLLIN : 0) | (out ? EPOLLOUT : 0),
+		.data = {
+			.fd = fd,
+		},
+	};
+	must_errno(epoll_ctl(ep, op, fd, &epoll), "watch Wayland socket");
+}
+
 static inline void arm_epollin_for(int ep, int fd, bool et, const char *desc) {
 	struct epoll_event epoll = {
 		.events = et ? EPOLLIN | EPOLLET : EPOLLIN,
@@ -314,6 +381,10 @@ int main(int argc, char *argv[]) {
 	if (config_read_opts(argc, argv, &state->config) < 0) {
 		return EXIT_FAILURE;
 	}
+	if (state->config.benchmark_frames) {
+		bottom_panel_benchmark(state, stdout);
+		return EXIT_SUCCESS;
+	}
 
 	state->display = wl_display_connect(NULL);
 	if (state->display == NULL) {
@@ -328,12 +399,25 @@ int main(int argc, char *argv[]) {
 
 	struct global_map_el *el = globals;
 	while (el->interface != NULL) {
-		if (*el->dest == NULL) {
+		if (*el->dest == NULL && !el->optional) {
 			wlchewing_err("Required Wayland interface not available: %s, version %d", el->interface->name, el->version);
 			return EXIT_FAILURE;
 		}
 		el++;
 	}
+	if (state->config.offload && (!state->wl_globals.subcompositor ||
+			!state->wl_globals.viewporter ||
+			!state->wl_globals.single_pixel_buffer_manager)) {
+		wlchewing_err("Compositor cannot draw candidate panel background, ignoring --offload");
+		state->config.offload = false;
+	}
+	if (state->config.strip && (!state->config.offload ||
+			memcmp(state->config.text_color,
+				state->config.selection_text_color,
+				sizeof(state->config.text_color)))) {
+		wlchewing_err("Candidate panel cannot be drawn once for all pages, ignoring --strip");
+		state->config.strip = false;
+	}
 	if (state->seat_name == UINT32_MAX) {
 		if (!state->config.seat) {
 			wlchewing_err("No seat found");
@@ -348,8 +432,9 @@ int main(int argc, char *argv[]) {
 
 	int epoll_fd = must_errno(epoll_create1(EPOLL_CLOEXEC), "setup epoll");
 
+	bool threaded = state->config.reader_thread;
 	int display_fd = wl_display_get_fd(state->display);
-	arm_epollin_for(epoll_fd, display_fd, false, "watch Wayland event");
+	watch_display(epoll_fd, EPOLL_CTL_ADD, display_fd, !threaded, false);
 
 	state->timerfd = must_errno(
 		timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC),
@@ -365,35 +450,116 @@ int main(int argc, char *argv[]) {
 	}
 
 	im_setup(state);
+	arm_epollin_for(epoll_fd, state->render_worker->event_fd, false,
+		"watch render worker");
+	if (threaded) {
+		arm_epollin_for(epoll_fd, state->reader->event_fd, false,
+			"watch reader thread");
+	}
+
+	// handled in the loop instead of async signal context
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	must_errno(sigprocmask(SIG_BLOCK, &signals, NULL), "block signals");
+	int signal_fd = must_errno(
+		signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC),
+		"create signalfd"
+	);
+	arm_epollin_for(epoll_fd, signal_fd, false, "watch signals");
+
+	constexpr int max_events = 8;
+	struct epoll_event events[max_events];
+	bool watching_out = false;
+	bool running = true;
+	while (running) {
+		// dispatch whatever is already queued before sleeping
+		bool flushed;
+		do {
+			must_errno(wl_display_dispatch_pending(state->display),
+				"process Wayland events");
+			// one update for everything handled so far, before a
+			// read is prepared as it may roundtrip
+			flushed = im_flush(state);
+		} while (!threaded &&
+			wl_display_prepare_read(state->display) != 0);
+		if (flushed == watching_out) {
+			watching_out = !flushed;
+			watch_display(epoll_fd, EPOLL_CTL_MOD, display_fd,
+				!threaded, watching_out);
+		}
 
-	struct sigaction sa;
-	sa.sa_handler = handle_signal;
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESETHAND;
-
-	must_errno(sigaction(SIGTERM, &sa, NULL), "set SIGTERM handler");
-	must_errno(sigaction(SIGINT, &sa, NULL), "set SIGINT handler");
-
-	struct epoll_event event_caught;
-	while (epoll_wait(epoll_fd, &event_caught, 1, -1)) {
-		if (event_caught.data.fd == display_fd) {
-			must_errno(
-				wl_display_dispatch(state->display),
-				"process Wayland events"
-			);
-		} else if (event_caught.data.fd == state->timerfd) {
-			uint64_t count = 0;
-			must_errno(
-				read(state->timerfd, &count, sizeof(uint64_t)),
-				"read from timer"
-			);
-			im_key_press(state, state->last_key);
-		} else if (state->config.tray_icon && event_caught.data.fd == bus_fd) {
-			must_errno(
-				errnoify(sd_bus_process(state->sni->bus, NULL)),
-				"process dbus message"
-			);
+		int n = epoll_wait(epoll_fd, events, max_events, -1);
+		if (n < 0) {
+			if (!threaded) {
+				wl_display_cancel_read(state->display);
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			must_errno(n, "wait for events");
+		}
+
+		// read Wayland first, handlers below may roundtrip
+		if (!threaded) {
+			bool display_readable = false;
+			for (int i = 0; i < n; i++) {
+				if (events[i].data.fd == display_fd &&
+						events[i].events &
+						(EPOLLIN | EPOLLERR | EPOLLHUP)) {
+					display_readable = true;
+				}
+			}
+			if (display_readable) {
+				must_errno(wl_display_read_events(
+					state->display), "read Wayland events");
+			} else {
+				wl_display_cancel_read(state->display);
+			}
+		}
+		must_errno(wl_display_dispatch_pending(state->display),
+			"process Wayland events");
+
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (threaded && fd == display_fd &&
+					events[i].events & (EPOLLERR | EPOLLHUP)) {
+				// reported even unasked, would wake us forever
+				wlchewing_err("Lost connection to compositor");
+				exit(EXIT_FAILURE);
+			} else if (fd == state->timerfd) {
+				uint64_t count = 0;
+				ssize_t ret = read(state->timerfd, &count,
+					sizeof(uint64_t));
+				if (ret < 0 && errno == EAGAIN) {
+					// disarmed in between
+					continue;
+				}
+				must_errno(ret, "read from timer");
+				im_key_repeat(state, count);
+			} else if (state->config.tray_icon && fd == bus_fd) {
+				int ret;
+				while ((ret = sd_bus_process(state->sni->bus,
+						NULL)) > 0);
+				must_errno(errnoify(ret), "process dbus message");
+			} else if (threaded && fd == state->reader->event_fd) {
+				uint64_t count;
+				ssize_t ret = read(fd, &count, sizeof(count));
+				if (ret < 0 && errno != EAGAIN) {
+					must_errno(ret, "read from eventfd");
+				}
+				im_handle_events(state);
+			} else if (fd == state->render_worker->event_fd) {
+				bottom_panel_handle_rendered(state);
+			} else if (fd == signal_fd) {
+				struct signalfd_siginfo info;
+				while (read(signal_fd, &info, sizeof(info)) > 0);
+				running = false;
+			}
 		}
 	}
+
+	teardown(state);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,272 @@
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "errors.h"
+#include "reader.h"
+#include "stats.h"
+#include "xmem.h"
+
+static void reader_wake(struct wlchewing_reader *reader) {
+	uint64_t one = 1;
+	if (write(reader->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		wlchewing_perr("Failed to wake logic thread");
+	}
+}
+
+static void reader_push(struct wlchewing_reader *reader,
+		struct wlchewing_event event) {
+	event.received_us = stats_now_us();
+	event.generation = event.type >= EVENT_KEYMAP ?
+		reader->keyboard_grab_generation :
+		reader->input_method_generation;
+	uint32_t tail = atomic_load_explicit(&reader->tail,
+		memory_order_relaxed);
+	while (tail - atomic_load_explicit(&reader->head,
+			memory_order_acquire) == reader_ring_size) {
+		// logic thread far behind, keys must not be dropped, and it may
+		// be waiting to create an object
+		reader_wake(reader);
+		pthread_mutex_unlock(&reader->dispatch_lock);
+		sched_yield();
+		pthread_mutex_lock(&reader->dispatch_lock);
+	}
+	reader->ring[tail % reader_ring_size] = event;
+	atomic_store_explicit(&reader->tail, tail + 1, memory_order_release);
+}
+
+bool reader_pop(struct wlchewing_reader *reader, struct wlchewing_event *event) {
+	uint32_t head = atomic_load_explicit(&reader->head,
+		memory_order_relaxed);
+	if (head == atomic_load_explicit(&reader->tail, memory_order_acquire)) {
+		return false;
+	}
+	*event = reader->ring[head % reader_ring_size];
+	atomic_store_explicit(&reader->head, head + 1, memory_order_release);
+	return true;
+}
+
+static void input_method_activate(void *data,
+		struct zwp_input_method_v2 *input_method) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_ACTIVATE,
+	});
+}
+
+static void input_method_deactivate(void *data,
+		struct zwp_input_method_v2 *input_method) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_DEACTIVATE,
+	});
+}
+
+static void input_method_content_type(void *data,
+		struct zwp_input_method_v2 *input_method, uint32_t hint,
+		uint32_t purpose) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_CONTENT_TYPE,
+		.content_type = {hint, purpose},
+	});
+}
+
+static void input_method_done(void *data,
+		struct zwp_input_method_v2 *input_method) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_DONE,
+	});
+}
+
+static void input_method_unavailable(void *data,
+		struct zwp_input_method_v2 *input_method) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_UNAVAILABLE,
+	});
+}
+
+static const struct zwp_input_method_v2_listener input_method_listener = {
+	.activate		= input_method_activate,
+	.deactivate		= input_method_deactivate,
+	.surrounding_text	=
+		(typeof(input_method_listener.surrounding_text))noop,
+	.text_change_cause	=
+		(typeof(input_method_listener.text_change_cause))noop,
+	.content_type		= input_method_content_type,
+	.done			= input_method_done,
+	.unavailable		= input_method_unavailable,
+};
+
+static void keyboard_grab_key(void *data,
+		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
+		uint32_t serial, uint32_t time,
+		uint32_t key, uint32_t key_state) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_KEY,
+		.key = {time, key, key_state},
+	});
+}
+
+static void keyboard_grab_modifiers(void *data,
+		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
+		uint32_t serial, uint32_t mods_depressed,
+		uint32_t mods_latched, uint32_t mods_locked, uint32_t group) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_MODIFIERS,
+		.modifiers = {mods_depressed, mods_latched, mods_locked, group},
+	});
+}
+
+static void keyboard_grab_keymap(void *data,
+		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
+		uint32_t format, int32_t fd, uint32_t size) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_KEYMAP,
+		.keymap = {format, fd, size},
+	});
+}
+
+static void keyboard_grab_repeat_info(void *data,
+		struct zwp_input_method_keyboard_grab_v2 *keyboard_grab,
+		int32_t rate, int32_t delay) {
+	reader_push(data, (struct wlchewing_event) {
+		.type = EVENT_REPEAT_INFO,
+		.repeat_info = {rate, delay},
+	});
+}
+
+static const struct zwp_input_method_keyboard_grab_v2_listener
+		keyboard_grab_listener = {
+	.key		= keyboard_grab_key,
+	.modifiers	= keyboard_grab_modifiers,
+	.keymap		= keyboard_grab_keymap,
+	.repeat_info	= keyboard_grab_repeat_info,
+};
+
+static void *reader_run(void *data) {
+	struct wlchewing_reader *reader = data;
+	struct pollfd fds[] = {
+		{
+			.fd = wl_display_get_fd(reader->display),
+			.events = POLLIN,
+		},
+		{
+			.fd = reader->stop_fd,
+			.events = POLLIN,
+		},
+	};
+	while (true) {
+		pthread_mutex_lock(&reader->dispatch_lock);
+		while (wl_display_prepare_read_queue(reader->display,
+				reader->queue) != 0) {
+			wl_display_dispatch_queue_pending(reader->display,
+				reader->queue);
+		}
+		pthread_mutex_unlock(&reader->dispatch_lock);
+		if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+			wlchewing_perr("Failed to wait for Wayland events");
+			wl_display_cancel_read(reader->display);
+			break;
+		}
+		if (fds[1].revents) {
+			wl_display_cancel_read(reader->display);
+			break;
+		}
+		if (!fds[0].revents) {
+			wl_display_cancel_read(reader->display);
+			continue;
+		}
+		if (wl_display_read_events(reader->display) < 0) {
+			// display is now in error, logic thread will notice
+			wlchewing_perr("Failed to read Wayland events");
+			reader_wake(reader);
+			break;
+		}
+		pthread_mutex_lock(&reader->dispatch_lock);
+		wl_display_dispatch_queue_pending(reader->display,
+			reader->queue);
+		pthread_mutex_unlock(&reader->dispatch_lock);
+		// events may also be for the default queue
+		reader_wake(reader);
+	}
+	return NULL;
+}
+
+struct wlchewing_reader *reader_start(struct wl_display *display,
+		struct zwp_input_method_manager_v2 *input_method_manager) {
+	struct wlchewing_reader *reader = xcalloc(1,
+		sizeof(struct wlchewing_reader));
+	reader->display = display;
+	reader->queue = wl_display_create_queue(display);
+	reader->input_method_manager = wl_proxy_create_wrapper(
+		input_method_manager);
+	wl_proxy_set_queue((struct wl_proxy *)reader->input_method_manager,
+		reader->queue);
+	pthread_mutex_init(&reader->dispatch_lock, NULL);
+	reader->event_fd = must_errno(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+		"create eventfd");
+	reader->stop_fd = must_errno(eventfd(0, EFD_CLOEXEC),
+		"create eventfd");
+	// as the render worker, left to the signalfd of the main thread
+	sigset_t signals, old_signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+	int ret = pthread_create(&reader->thread, NULL, reader_run, reader);
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+	if (ret) {
+		errno = ret;
+		wlchewing_perr("Failed to start reader thread");
+		exit(EXIT_FAILURE);
+	}
+	return reader;
+}
+
+void reader_stop(struct wlchewing_reader *reader) {
+	uint64_t one = 1;
+	must_errno(write(reader->stop_fd, &one, sizeof(one)),
+		"stop reader thread");
+	pthread_join(reader->thread, NULL);
+	struct wlchewing_event event;
+	while (reader_pop(reader, &event)) {
+		if (event.type == EVENT_KEYMAP) {
+			close(event.keymap.fd);
+		}
+	}
+	close(reader->event_fd);
+	close(reader->stop_fd);
+	pthread_mutex_destroy(&reader->dispatch_lock);
+	wl_proxy_wrapper_destroy(reader->input_method_manager);
+	wl_event_queue_destroy(reader->queue);
+	free(reader);
+}
+
+struct zwp_input_method_v2 *reader_get_input_method(
+		struct wlchewing_reader *reader, struct wl_seat *seat) {
+	pthread_mutex_lock(&reader->dispatch_lock);
+	struct zwp_input_method_v2 *input_method =
+		zwp_input_method_manager_v2_get_input_method(
+		reader->input_method_manager, seat);
+	zwp_input_method_v2_add_listener(input_method, &input_method_listener,
+		reader);
+	reader->input_method_generation++;
+	pthread_mutex_unlock(&reader->dispatch_lock);
+	return input_method;
+}
+
+struct zwp_input_method_keyboard_grab_v2 *reader_grab_keyboard(
+		struct wlchewing_reader *reader,
+		struct zwp_input_method_v2 *input_method) {
+	pthread_mutex_lock(&reader->dispatch_lock);
+	// on queue as the input method is
+	struct zwp_input_method_keyboard_grab_v2 *keyboard_grab =
+		zwp_input_method_v2_grab_keyboard(input_method);
+	if (keyboard_grab) {
+		zwp_input_method_keyboard_grab_v2_add_listener(keyboard_grab,
+			&keyboard_grab_listener, reader);
+		reader->keyboard_grab_generation++;
+	}
+	pthread_mutex_unlock(&reader->dispatch_lock);
+	return keyboard_grab;
+}
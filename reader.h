@@ -0,0 +1,98 @@
+#ifndef READER_H
+#define READER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#include "input-method-unstable-v2-client-protocol.h"
+
+enum wlchewing_event_type {
+	EVENT_ACTIVATE,
+	EVENT_DEACTIVATE,
+	EVENT_CONTENT_TYPE,
+	EVENT_DONE,
+	EVENT_UNAVAILABLE,
+	EVENT_KEYMAP,
+	EVENT_KEY,
+	EVENT_MODIFIERS,
+	EVENT_REPEAT_INFO,
+};
+
+// input method and keyboard grab events, as queued by the reader thread
+struct wlchewing_event {
+	enum wlchewing_event_type type;
+	// of the object when queued, to drop events of destroyed ones, whose
+	// proxy pointer may have been reused
+	uint32_t generation;
+	uint64_t received_us;
+	union {
+		struct {
+			uint32_t hint, purpose;
+		} content_type;
+		struct {
+			uint32_t format;
+			int32_t fd;
+			uint32_t size;
+		} keymap;
+		struct {
+			uint32_t time, key, state;
+		} key;
+		struct {
+			uint32_t depressed, latched, locked, group;
+		} modifiers;
+		struct {
+			int32_t rate, delay;
+		} repeat_info;
+	};
+};
+
+// power of 2
+static constexpr uint32_t reader_ring_size = 256;
+
+struct wlchewing_reader {
+	struct wl_display *display;
+	// input method and its keyboard grab live here
+	struct wl_event_queue *queue;
+	// creates input methods on queue
+	struct zwp_input_method_manager_v2 *input_method_manager;
+	// held while queue is dispatched, so that objects get their listener
+	// before any of their events
+	pthread_mutex_t dispatch_lock;
+	// bumped under dispatch_lock for each object created, EVENT_KEYMAP
+	// and after are keyboard grab events
+	uint32_t input_method_generation;
+	uint32_t keyboard_grab_generation;
+	pthread_t thread;
+	int event_fd; // wakes logic thread
+	int stop_fd;
+
+	// single producer, single consumer
+	struct wlchewing_event ring[reader_ring_size];
+	_Atomic uint32_t head; // written by logic thread
+	_Atomic uint32_t tail; // written by reader thread
+};
+
+struct wlchewing_reader *reader_start(struct wl_display *display,
+	struct zwp_input_method_manager_v2 *input_method_manager);
+
+void reader_stop(struct wlchewing_reader *reader);
+
+// logic thread only, created on queue with listeners set
+struct zwp_input_method_v2 *reader_get_input_method(
+	struct wlchewing_reader *reader, struct wl_seat *seat);
+
+struct zwp_input_method_keyboard_grab_v2 *reader_grab_keyboard(
+	struct wlchewing_reader *reader,
+	struct zwp_input_method_v2 *input_method);
+
+// logic thread only
+bool reader_pop(struct wlchewing_reader *reader, struct wlchewing_event *event);
+
+static inline uint32_t reader_depth(struct wlchewing_reader *reader) {
+	return atomic_load_explicit(&reader->tail, memory_order_acquire) -
+		atomic_load_explicit(&reader->head, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include <inttypes.h>
+
+#include "cell-cache.h"
+#include "glyph-atlas.h"
+#include "layout-cache.h"
+#include "stats.h"
+#include "wlchewing.h"
+
+void stats_record(struct wlchewing_latency *latency, uint64_t since_us) {
+	uint64_t us = stats_now_us() - since_us;
+	latency->count++;
+	latency->total_us += us;
+	if (us > latency->max_us) {
+		latency->max_us = us;
+	}
+}
+
+void stats_record_depth(struct wlchewing_stats *stats, uint32_t depth) {
+	stats->queue_depth_samples++;
+	stats->queue_depth_total += depth;
+	if (depth > stats->queue_depth_max) {
+		stats->queue_depth_max = depth;
+	}
+}
+
+static void ack_done(void *data, struct wl_callback *callback,
+		uint32_t callback_data) {
+	struct wlchewing_state *state = data;
+	struct wlchewing_stats *stats = &state->stats;
+	wl_callback_destroy(callback);
+	stats_record(&stats->key_ack,
+		stats->pending_acks[stats->pending_acks_head]);
+	stats->pending_acks_head =
+		(stats->pending_acks_head + 1) % stats_max_pending_acks;
+	stats->pending_acks_len--;
+}
+
+static const struct wl_callback_listener ack_listener = {
+	.done	= ack_done,
+};
+
+void stats_track_ack(struct wlchewing_state *state, uint64_t since_us) {
+	struct wlchewing_stats *stats = &state->stats;
+	if (stats->pending_acks_len == stats_max_pending_acks) {
+		// compositor far behind, skip this sample
+		return;
+	}
+	stats->pending_acks[(stats->pending_acks_head +
+		stats->pending_acks_len) % stats_max_pending_acks] = since_us;
+	stats->pending_acks_len++;
+	struct wl_callback *callback = wl_display_sync(state->display);
+	wl_callback_add_listener(callback, &ack_listener, state);
+}
+
+static void dump_latency(FILE *f, const char *name,
+		const struct wlchewing_latency *latency) {
+	fprintf(f, "%-16s count %8" PRIu64 " avg %8.1fus max %8" PRIu64 "us\n", name,
+		latency->count,
+		latency->count ? (double)latency->total_us / latency->count : 0,
+		latency->max_us);
+}
+
+static void dump_cache(FILE *f, const char *name, uint64_t hits,
+		uint64_t misses, uint64_t evictions) {
+	fprintf(f, "%-16s hits %9" PRIu64 " misses %6" PRIu64
+		" rate %5.1f%% evicted %" PRIu64 "\n", name, hits, misses,
+		hits + misses ? 100.0 * hits / (hits + misses) : 0, evictions);
+}
+
+void stats_dump(struct wlchewing_state *state, FILE *f) {
+	struct wlchewing_stats *stats = &state->stats;
+	fprintf(f, "wlchewing stats (%s key path)\n",
+		state->config.roundtrip_per_key ? "roundtrip" : "async");
+	dump_latency(f, "key handling", &stats->key_handling);
+	dump_latency(f, "key ack", &stats->key_ack);
+	fprintf(f, "%-16s count %8" PRIu64 "\n", "vte hack", stats->vte_hacks);
+	dump_latency(f, "roundtrip", &stats->roundtrip);
+	fprintf(f, "%-16s count %8" PRIu64 "\n", "roundtrip overrun",
+		stats->roundtrip_overruns);
+	if (state->reader) {
+		dump_latency(f, "queue wait", &stats->queue_wait);
+		fprintf(f, "%-16s count %8" PRIu64 " avg %8.1f   max %8" PRIu64 "\n",
+			"queue depth", stats->queue_depth_samples,
+			stats->queue_depth_samples ?
+			(double)stats->queue_depth_total /
+			stats->queue_depth_samples : 0,
+			stats->queue_depth_max);
+	}
+	if (state->render_worker) {
+		struct wlchewing_layout_cache *layouts =
+			state->render_worker->layout_cache;
+		dump_cache(f, "layout cache", atomic_load(&layouts->lru.hits),
+			atomic_load(&layouts->lru.misses),
+			atomic_load(&layouts->lru.evictions));
+		struct wlchewing_cell_cache *cells =
+			state->render_worker->cell_cache;
+		dump_cache(f, "cell cache", atomic_load(&cells->lru.hits),
+			atomic_load(&cells->lru.misses),
+			atomic_load(&cells->lru.evictions));
+		if (state->config.renderer == RENDERER_GLYPH) {
+			struct wlchewing_glyph_atlas *glyphs =
+				state->render_worker->glyph_atlas;
+			// evicted counts the times it was cleared
+			dump_cache(f, "glyph atlas", atomic_load(&glyphs->hits),
+				atomic_load(&glyphs->misses),
+				atomic_load(&glyphs->resets));
+		}
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct wlchewing_state;
+
+struct wlchewing_latency {
+	uint64_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+};
+
+// acks are answered in order, so pending ones form a fifo
+static constexpr int stats_max_pending_acks = 64;
+
+struct wlchewing_stats {
+	// time spent in the key handler, i.e. event loop blocked
+	struct wlchewing_latency key_handling;
+	// key event to compositor having processed our response
+	struct wlchewing_latency key_ack;
+	// input method recreated to work around VTE
+	uint64_t vte_hacks;
+	// with --reader-thread, event read to handled
+	struct wlchewing_latency queue_wait;
+	// events waiting when logic thread wakes up
+	uint64_t queue_depth_samples, queue_depth_total, queue_depth_max;
+	// waits for compositor, and those given up after the budget
+	struct wlchewing_latency roundtrip;
+	uint64_t roundtrip_overruns;
+
+	uint64_t pending_acks[stats_max_pending_acks];
+	int pending_acks_head, pending_acks_len;
+};
+
+static inline uint64_t stats_now_us() {
+	struct timespec spec;
+	clock_gettime(CLOCK_MONOTONIC, &spec);
+	return spec.tv_sec * 1000 * 1000 + spec.tv_nsec / 1000;
+}
+
+void stats_record(struct wlchewing_latency *latency, uint64_t since_us);
+
+void stats_record_depth(struct wlchewing_stats *stats, uint32_t depth);
+
+void stats_track_ack(struct wlchewing_state *state, uint64_t since_us);
+
+void stats_dump(struct wlchewing_state *state, FILE *f);
+
+#endif
@@ -0,0 +1,76 @@
+#include <poll.h>
+#include <stdlib.h>
+
+#include "watchdog.h"
+#include "wlchewing.h"
+
+static void sync_done(void *data, struct wl_callback *callback,
+		uint32_t callback_data) {
+	bool *done = data;
+	*done = true;
+	wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener sync_listener = {
+	.done	= sync_done,
+};
+
+bool watchdog_roundtrip(struct wlchewing_state *state, const char *what) {
+	struct wl_display *display = state->display;
+	uint64_t start = stats_now_us();
+	uint64_t deadline = start + state->config.roundtrip_budget_ms * 1000;
+	bool done = false;
+	struct wl_callback *callback = wl_display_sync(display);
+	wl_callback_add_listener(callback, &sync_listener, &done);
+
+	struct pollfd pfd = {
+		.fd = wl_display_get_fd(display),
+	};
+	while (true) {
+		while (wl_display_prepare_read(display) != 0) {
+			if (wl_display_dispatch_pending(display) < 0) {
+				wlchewing_perr("Failed to process Wayland events");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if (done) {
+			wl_display_cancel_read(display);
+			break;
+		}
+		pfd.events = POLLIN;
+		if (wl_display_flush(display) < 0) {
+			if (errno != EAGAIN) {
+				wl_display_cancel_read(display);
+				wlchewing_perr("Failed to flush Wayland requests");
+				exit(EXIT_FAILURE);
+			}
+			pfd.events |= POLLOUT;
+		}
+
+		uint64_t now = stats_now_us();
+		if (now >= deadline) {
+			wl_display_cancel_read(display);
+			// the reply may still come, but not to this stack frame
+			wl_callback_destroy(callback);
+			state->stats.roundtrip_overruns++;
+			wlchewing_err("Compositor did not respond in %dms while %s",
+				state->config.roundtrip_budget_ms, what);
+			return false;
+		}
+		int ret = poll(&pfd, 1, (deadline - now + 999) / 1000);
+		if (ret <= 0 || !(pfd.revents & (POLLIN | POLLERR | POLLHUP))) {
+			wl_display_cancel_read(display);
+			if (ret < 0 && errno != EINTR) {
+				wlchewing_perr("Failed to wait for compositor");
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+		if (wl_display_read_events(display) < 0) {
+			wlchewing_perr("Failed to read Wayland events");
+			exit(EXIT_FAILURE);
+		}
+	}
+	stats_record(&state->stats.roundtrip, start);
+	return true;
+}
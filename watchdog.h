@@ -0,0 +1,10 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+struct wlchewing_state;
+
+// wl_display_roundtrip, but giving up after --roundtrip-budget
+// returns false on overrun, which is logged and counted
+bool watchdog_roundtrip(struct wlchewing_state *state, const char *what);
+
+#endif
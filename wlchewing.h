@@ -15,14 +15,24 @@
 
 #include "bottom-panel.h"
 #include "config.h"
+#include "keymap.h"
+#include "keyset.h"
+#include "reader.h"
 #include "sni.h"
+#include "stats.h"
+#include "watchdog.h"
+#include "fractional-scale-v1-client-protocol.h"
 #include "input-method-unstable-v2-client-protocol.h"
+#include "single-pixel-buffer-v1-client-protocol.h"
 #include "text-input-unstable-v3-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "virtual-keyboard-unstable-v1-client-protocol.h"
 
-struct wlchewing_keysym {
-	uint32_t key;
-	struct wl_list link;
+struct wlchewing_preedit {
+	char *text;
+	size_t size;
+	int length;
+	int cursor_begin, cursor_end; // in bytes
 };
 
 struct wlchewing_wl_globals {
@@ -32,6 +42,11 @@ struct wlchewing_wl_globals {
 	struct zwp_input_method_manager_v2 *input_method_manager;
 	struct zwp_virtual_keyboard_manager_v1 *virtual_keyboard_manager;
 	struct zwlr_layer_shell_v1 *layer_shell;
+	// optional, NULL if not available
+	struct wl_subcompositor *subcompositor;
+	struct wp_viewporter *viewporter;
+	struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager;
+	struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
 };
 
 struct wlchewing_state {
@@ -43,41 +58,64 @@ struct wlchewing_state {
 
 	struct zwp_input_method_v2 *input_method;
 	struct zwp_input_method_keyboard_grab_v2 *keyboard_grab;
+	struct wlchewing_reader *reader; // with --reader-thread
 	bool pending_activate;
 	bool activated;
+	uint32_t pending_content_hint, pending_content_purpose;
+	uint32_t content_purpose;
 	int32_t serial;
+	// recreated by vte_hack, updates wait for its first done
+	bool awaiting_done;
 
 	struct zwp_virtual_keyboard_v1 *virtual_keyboard;
 
 	struct wl_pointer *pointer;
+	struct wl_surface *pointer_surface; // the one pointer is over
+	double pointer_x;
 	wl_fixed_t pending_axis[2];
 	uint32_t pending_source;
 	bool has_discrete;
 	double acc_axis[2];
 	uint32_t acc_source;
 
-	struct wlchewing_bottom_panel *bottom_panel;
+	struct wlchewing_bottom_panel *bottom_panel; // while open
+	struct wlchewing_bottom_panel *persistent_bottom_panel;
 	PangoLayout *bottom_panel_text_layout;
 	PangoLayout *bottom_panel_key_hint_layout;
 	uint32_t bottom_panel_text_height;
+	struct wlchewing_render_worker *render_worker;
 
 	struct wlchewing_sni *sni;
 
 	ChewingContext *chewing;
 	bool forwarding;
+	bool bypass; // by content type of the focused field
+	bool pending_update;
+	bool pending_render;
+	struct wlchewing_preedit preedit, sent_preedit;
+	char *pending_commit;
+	size_t pending_commit_length, pending_commit_size;
 
 	struct xkb_context *xkb_context;
 	struct xkb_state *xkb_state;
-	char *keymap;
-	size_t keymap_size;
+	struct wlchewing_keymap *keymap; // in use for translation
+	struct wlchewing_keymap *default_keymap;
+	struct wlchewing_keymap_cache keymap_cache;
+	xkb_mod_mask_t mods_depressed, mods_latched, mods_locked;
+	xkb_layout_index_t group;
+	xkb_mod_mask_t mods; // effective
+	bool xkb_state_stale; // not updated in English mode
 	struct itimerspec repeat_info;
 
 	uint32_t last_key;
 	int timerfd;
 	bool shift_only;
-	struct wl_list pending_handled_keysyms; // wlchewing_keysym
-	struct wl_list press_sent_keysyms; // wlchewing_keysym
+	struct wlchewing_keyset pending_handled_keys;
+	struct wlchewing_keyset press_sent_keys;
 	int32_t millis_offset;
+
+	struct wlchewing_stats stats;
+	uint64_t key_start_us; // key being handled, for ack tracking
 };
 
 void im_setup(struct wlchewing_state *state);
@@ -89,10 +127,16 @@ enum press_action {
 	PRESS_ARM_TIMER,
 };
 
-enum press_action im_key_press(struct wlchewing_state *state, uint32_t key);
+enum press_action im_key_press(struct wlchewing_state *state, uint32_t key,
+	int count);
+void im_key_repeat(struct wlchewing_state *state, uint64_t expirations);
 void im_release_all_keys(struct wlchewing_state *state);
+bool im_flush(struct wlchewing_state *state);
+
+void im_handle_events(struct wlchewing_state *state);
 
 void im_candidates_move_by(struct wlchewing_state *state, int diff);
+void im_candidates_page_by(struct wlchewing_state *state, int diff);
 void im_commit_candidate(struct wlchewing_state *state, int offset);
 
 void im_mode_switch(struct wlchewing_state *state, bool forwarding);
@@ -7,6 +7,7 @@
 #include "wlchewing.h"
 
 #define xcalloc(...) _xcalloc(__FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)
+#define xrealloc(...) _xrealloc(__FILE__, __LINE__ __VA_OPT__(,) __VA_ARGS__)
 
 static inline void *assert_pointer(const char *f, int l, const char *op, void *p) {
 	if (p == NULL) {
@@ -20,4 +21,8 @@ static inline void *assert_pointer(const char *f, int l, const char *op, void *p
 	return assert_pointer(f, l, &__func__[2], calloc(nmemb, size));
 }
 
+[[maybe_unused]] static inline void *_xrealloc(const char *f, int l, void *ptr, size_t size) {
+	return assert_pointer(f, l, &__func__[2], realloc(ptr, size));
+}
+
 #endif